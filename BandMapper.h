@@ -0,0 +1,35 @@
+#ifndef BANDMAPPER_H
+#define BANDMAPPER_H
+
+#include "Image.h"
+#include "NearestColor.h"
+#include "ThreadPool.h"
+#include "ErrorDiffusion.h"
+#include <vector>
+
+//Maps an image w x h that arrives as consecutive bands of rows, so it never has to be in memory at once (see ImageStream).
+//The dithering error of the last row is carried to the next band, the result is the same as Image::SetPalette on the whole image.
+//Implemented in Image.cpp with the rest of the mapping
+class BandMapper
+{
+public:
+	BandMapper(ColorRGB* palette, int k, int w, int h, bool dithering, int num_threads = 1, NearestBackend backend = Nearest_Auto);
+
+	//Replaces the colors of the next band, bands must come in order
+	void SetPalette(Image& band);
+
+private:
+	std::vector< ColorRGB > palette;
+	int w, h;
+	int next_row;
+	NearestBackend backend;
+	NearestColor nearest;
+	ThreadPool pool;
+	ErrorDiffusion error;
+	bool dithering;
+
+	BandMapper(const BandMapper&);
+	BandMapper& operator=(const BandMapper&);
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "ColorLUT.h"
+#include "InverseColormap.h"
+#include "ThreadPool.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <atomic>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define COLORLUT_MAGIC "ZQLUT\0\0"
+
+//Palette bytes are padded so the table starts aligned
+static size_t PaletteBytes(int k)
+{
+	return (k * 3 + 15) & ~15;
+}
+
+void ColorLUT::Build(const ColorRGB* palette, int k, bool lazy, int num_threads)
+{
+	this->k = k;
+	this->lazy = lazy;
+	this->palette.assign(palette, palette + k);
+	file.Close();
+
+	if(k <= 256)
+	{
+		table8.resize(COLORLUT_SIZE);
+		table16.clear();
+	}
+	else
+	{
+		table16.resize(COLORLUT_SIZE);
+		table8.clear();
+	}
+	entries8 = table8.empty() ? 0 : &table8[0];
+	entries16 = table16.empty() ? 0 : &table16[0];
+
+	if(lazy)
+	{
+		filled.assign(COLORLUT_SIZE / 32, 0);
+		simd.Reset(palette, k);
+		return;
+	}
+	filled.clear();
+
+	//Each task fills the 64K colors of one red value
+	InverseColormap grid;
+	grid.Build(palette, k);
+	ThreadPool pool(num_threads);
+	pool.Run(256, [&](int r)
+	{
+		for(int g = 0; g < 256; ++g)
+		{
+			unsigned int key = (r << 16) | (g << 8);
+			for(int b = 0; b < 256; ++b, ++key)
+			{
+				int index = grid.FindClosest(ColorRGB((unsigned char)r, (unsigned char)g, (unsigned char)b));
+				if(k <= 256)
+					table8[key] = (unsigned char)index;
+				else
+					table16[key] = (unsigned short)index;
+			}
+		}
+	});
+}
+
+int ColorLUT::Fill(unsigned int key, const ColorRGB& color) const
+{
+	int index = simd.FindClosest(color);
+	if(k <= 256)
+		table8[key] = (unsigned char)index;
+	else
+		table16[key] = (unsigned short)index;
+	filled[key >> 5] |= 1u << (key & 31);
+	return index;
+}
+
+unsigned long long ColorLUT::PaletteHash(const ColorRGB* palette, int k)
+{
+	//FNV-1a of the size and the colors
+	unsigned long long hash = 14695981039346656037ull;
+	unsigned char bytes[4] = { (unsigned char)k, (unsigned char)(k >> 8), (unsigned char)(k >> 16), (unsigned char)(k >> 24) };
+	for(int i = 0; i < 4; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	for(int c = 0; c < k; ++c)
+	{
+		for(int i = 0; i < 3; ++i)
+			hash = (hash ^ palette[c][i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+bool ColorLUT::Save(const char* path) const
+{
+	if(k == 0)
+		return false;
+
+	if(lazy)
+	{
+		for(unsigned int key = 0; key < COLORLUT_SIZE; ++key)
+		{
+			if(!(filled[key >> 5] & (1u << (key & 31))))
+				Fill(key, ColorRGB((unsigned char)(key >> 16), (unsigned char)(key >> 8), (unsigned char)key));
+		}
+	}
+
+	ColorLUTHeader header;
+	memcpy(header.magic, COLORLUT_MAGIC, 8);
+	header.version = COLORLUT_FILE_VERSION;
+	header.metric_version = COLORLUT_METRIC_VERSION;
+	header.k = k;
+	header.entry_size = k <= 256 ? 1 : 2;
+	header.palette_hash = PaletteHash(&palette[0], k);
+
+	std::vector< unsigned char > palette_bytes(PaletteBytes(k), 0);
+	memcpy(&palette_bytes[0], &palette[0], k * 3);
+
+	//Every writer has its own temporary file, threads and processes saving the same table at once must not rename each other's partial files
+	static std::atomic< unsigned int > num_saves(0);
+	char suffix[64];
+	sprintf(suffix, ".%d.%u.tmp", (int)getpid(), num_saves++);
+	std::string tmp_path = std::string(path) + suffix;
+	FILE* out = fopen(tmp_path.c_str(), "wb");
+	if(!out)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	ok = ok && fwrite(&palette_bytes[0], 1, palette_bytes.size(), out) == palette_bytes.size();
+	if(k <= 256)
+		ok = ok && fwrite(entries8, 1, COLORLUT_SIZE, out) == COLORLUT_SIZE;
+	else
+		ok = ok && fwrite(entries16, 2, COLORLUT_SIZE, out) == COLORLUT_SIZE;
+	ok = fclose(out) == 0 && ok;
+
+	//rename doesn't replace existing files on Windows
+	if(ok && rename(tmp_path.c_str(), path) != 0)
+	{
+		remove(path);
+		ok = rename(tmp_path.c_str(), path) == 0;
+	}
+	if(!ok)
+		remove(tmp_path.c_str());
+	return ok;
+}
+
+bool ColorLUT::Load(const char* path, const ColorRGB* palette, int k)
+{
+	MappedFile mapped;
+	if(!mapped.Open(path) || mapped.size < sizeof(ColorLUTHeader))
+		return false;
+
+	ColorLUTHeader header;
+	memcpy(&header, mapped.data, sizeof(header));
+	if(memcmp(header.magic, COLORLUT_MAGIC, 8) || header.version != COLORLUT_FILE_VERSION || header.metric_version != COLORLUT_METRIC_VERSION)
+		return false;
+	if(header.k == 0 || header.k > 65535 || header.entry_size != (header.k <= 256 ? 1u : 2u))
+		return false;
+	if(mapped.size != sizeof(header) + PaletteBytes(header.k) + (size_t)COLORLUT_SIZE * header.entry_size)
+		return false;
+
+	const ColorRGB* file_palette = (const ColorRGB*)(mapped.data + sizeof(header));
+	if(header.palette_hash != PaletteHash(file_palette, header.k))
+		return false;
+	if(palette && ((int)header.k != k || memcmp(palette, file_palette, k * 3)))
+		return false;
+
+	this->k = header.k;
+	lazy = false;
+	this->palette.assign(file_palette, file_palette + header.k);
+	table8.clear();
+	table16.clear();
+	filled.clear();
+
+	const unsigned char* table = mapped.data + sizeof(header) + PaletteBytes(header.k);
+	entries8 = header.k <= 256 ? table : 0;
+	entries16 = header.k <= 256 ? 0 : (const unsigned short*)table;
+
+	//The mapping moves to this LUT
+	file.Swap(mapped);
+	return true;
+}
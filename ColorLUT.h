@@ -0,0 +1,75 @@
+#ifndef COLORLUT_H
+#define COLORLUT_H
+
+#include "Image.h"
+#include "SIMDPalette.h"
+#include "MappedFile.h"
+#include <vector>
+
+#define COLORLUT_SIZE (1 << 24)
+
+//File format version and version of the distance used to fill the table (squared RGB distance, lowest index on ties),
+//files with other versions are rejected
+#define COLORLUT_FILE_VERSION 1
+#define COLORLUT_METRIC_VERSION 1
+
+//Header of LUT files, followed by the palette (padded to 16 bytes) and the table
+class ColorLUTHeader
+{
+public:
+	char magic[8];
+	unsigned int version;
+	unsigned int metric_version;
+	unsigned int k;
+	unsigned int entry_size;
+	unsigned long long palette_hash;
+};
+
+//Closest palette index of every 24 bit color, 1 byte per color for up to 256 colors and 2 bytes for more.
+//Filled eagerly (with several threads) or lazily on the first search of each color, the lazy table can only be used by one thread.
+//Tables can be saved and then mapped read-only from the file, so processes using the same palette share one copy
+class ColorLUT
+{
+public:
+	int k;
+	bool lazy;
+	std::vector< ColorRGB > palette;
+
+	ColorLUT() : k(0), lazy(false), entries8(0), entries16(0) {}
+
+	//Eager builds use num_threads threads (0 for all the cores)
+	void Build(const ColorRGB* palette, int k, bool lazy, int num_threads = 1);
+
+	//Lazy tables are completed before saving. Written to a temporary file first so readers never map a partial one
+	bool Save(const char* path) const;
+
+	//Maps a saved table. With a palette the file must have been built for exactly that palette, otherwise the palette of the file is taken
+	bool Load(const char* path, const ColorRGB* palette = 0, int k = 0);
+
+	static unsigned long long PaletteHash(const ColorRGB* palette, int k);
+
+	int FindClosest(const ColorRGB& color) const
+	{
+		unsigned int key = (color.R << 16) | (color.G << 8) | color.B;
+		if(lazy && !(filled[key >> 5] & (1u << (key & 31))))
+			return Fill(key, color);
+		return k <= 256 ? entries8[key] : entries16[key];
+	}
+
+private:
+	//Tables built in memory, written on lazy misses
+	mutable std::vector< unsigned char > table8;
+	mutable std::vector< unsigned short > table16;
+	//Table in use, pointing to the ones above or to the mapped file
+	const unsigned char* entries8;
+	const unsigned short* entries16;
+	MappedFile file;
+
+	//Lazy mode only, a bit per color and the search used on misses
+	mutable std::vector< unsigned int > filled;
+	SIMDPalette simd;
+
+	int Fill(unsigned int key, const ColorRGB& color) const;
+};
+
+#endif
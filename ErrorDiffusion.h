@@ -0,0 +1,65 @@
+#ifndef ERRORDIFFUSION_H
+#define ERRORDIFFUSION_H
+
+#include "Image.h"
+#include <vector>
+#include <cstring>
+
+//Floyd–Steinberg error kept apart from the image, in rolling rows of int16
+//Errors are stored in 1/16 of a level (the kernel denominator) so weights are integer and the final division is a shift
+//The error of each pixel is taken from its clamped value, so accumulated error is at most 16 * 255 and never overflows
+class ErrorDiffusion
+{
+public:
+	int w;
+	int num_rows;
+	std::vector< short > rows;
+
+	//Each row in use must be written by one thread at a time, dithering rows in parallel needs threads + 2 rows
+	ErrorDiffusion(int w, int num_rows = 2) : w(w), num_rows(num_rows)
+	{
+		//One pixel of padding on each side
+		rows.assign(num_rows * Stride(), 0);
+	}
+
+	int Stride() const
+	{
+		return (w + 2) * 3;
+	}
+
+	short* Row(int y)
+	{
+		return &rows[(y % num_rows) * Stride() + 3];
+	}
+
+	//Must be called before the first pixel of row y
+	void StartRow(int y)
+	{
+		if(y == 0)
+			memset(Row(0) - 3, 0, Stride() * sizeof(short));
+		memset(Row(y + 1) - 3, 0, Stride() * sizeof(short));
+	}
+
+	//Source color plus the error it received, this is the color that must be looked up in the palette
+	ColorRGB Get(int x, int y, const unsigned char* src)
+	{
+		const short* err = Row(y) + x * 3;
+		return ColorRGB(Clamp((src[0] * 16 + err[0] + 8) >> 4, 0, 255), Clamp((src[1] * 16 + err[1] + 8) >> 4, 0, 255), Clamp((src[2] * 16 + err[2] + 8) >> 4, 0, 255));
+	}
+
+	void Diffuse(int x, int y, const ColorRGB& color, const ColorRGB& nearest_color)
+	{
+		short* cur = Row(y) + x * 3;
+		short* next = Row(y + 1) + x * 3;
+		for(int c = 0; c < 3; ++c)
+		{
+			int e = color[c] - nearest_color[c];
+			cur[c + 3] += (short)(e * 7);
+			next[c - 3] += (short)(e * 3);
+			next[c] += (short)(e * 5);
+			next[c + 3] += (short)e;
+		}
+	}
+};
+
+#endif
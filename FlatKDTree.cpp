@@ -0,0 +1,72 @@
+#include "FlatKDTree.h"
+#include <algorithm>
+
+class FlatEntryCmp
+{
+public:
+	int axis;
+	FlatEntryCmp(int axis) : axis(axis) {}
+
+	bool operator()(const FlatKDTree::Entry& e1, const FlatKDTree::Entry& e2) const
+	{
+		return e1.color[axis] < e2.color[axis];
+	}
+};
+
+void FlatKDTree::Build(const ColorRGB* palette, int k)
+{
+	colors.assign(palette, palette + k);
+
+	entries.resize(k);
+	for(int c = 0; c < k; ++c)
+	{
+		entries[c].color = palette[c];
+		entries[c].index = (unsigned short)c;
+	}
+
+	//An empty palette is one leaf without entries, FindClosest returns -1
+	nodes.clear();
+	nodes.reserve(2 * k / FLATKDTREE_BUCKET + 1);
+	BuildR(entries.data(), entries.data() + k);
+}
+
+//Appends the subtree of [begin, end) in preorder and returns the index of its root
+int FlatKDTree::BuildR(Entry* begin, Entry* end)
+{
+	int n = (int)nodes.size();
+	nodes.push_back(Node());
+	if(end - begin <= FLATKDTREE_BUCKET)
+	{
+		nodes[n].axis = FLATKDTREE_LEAF;
+		nodes[n].start = (unsigned short)(begin - entries.data());
+		nodes[n].count = (unsigned short)(end - begin);
+		return n;
+	}
+
+	//Split on the axis with the largest extent
+	int min_c[3] = { 255, 255, 255 };
+	int max_c[3] = { 0, 0, 0 };
+	for(Entry* it = begin; it != end; ++it)
+	{
+		for(int a = 0; a < 3; ++a)
+		{
+			min_c[a] = std::min(min_c[a], (int)it->color[a]);
+			max_c[a] = std::max(max_c[a], (int)it->color[a]);
+		}
+	}
+	int axis = 0;
+	for(int a = 1; a < 3; ++a)
+	{
+		if(max_c[a] - min_c[a] > max_c[axis] - min_c[axis])
+			axis = a;
+	}
+
+	Entry* mid = begin + (end - begin) / 2;
+	std::nth_element(begin, mid, end, FlatEntryCmp(axis));
+	nodes[n].axis = (unsigned char)axis;
+	nodes[n].split = mid->color[axis];
+
+	BuildR(begin, mid);
+	nodes[n].right = (unsigned short)BuildR(mid, end);
+	return n;
+}
@@ -0,0 +1,102 @@
+#ifndef FLATKDTREE_H
+#define FLATKDTREE_H
+
+#include "Image.h"
+#include <vector>
+#include <climits>
+
+//Max palette entries in a leaf, scanning a few colors in a row is cheaper than going deeper
+#define FLATKDTREE_BUCKET 8
+//Axis value of leaf nodes
+#define FLATKDTREE_LEAF 3
+
+//KD-tree of a palette without pointers. Nodes are stored in one array in preorder, so the left child of a node is the next one
+//and only the right child index is kept. Leaves own a range of the palette colors, stored inline in tree order. Palettes up to 65535 colors
+class FlatKDTree
+{
+public:
+	class Node
+	{
+	public:
+		unsigned char axis;   //Split axis or FLATKDTREE_LEAF
+		unsigned char split;  //Colors on the left are <= split and on the right >= split
+		unsigned short right; //Right child of split nodes
+		unsigned short start; //Range of entries of leaves
+		unsigned short count;
+	};
+
+	class Entry
+	{
+	public:
+		ColorRGB color;
+		unsigned short index;
+	};
+
+	std::vector< Node > nodes;
+	std::vector< Entry > entries;
+	std::vector< ColorRGB > colors; //Palette order, used for the seed
+
+	void Build(const ColorRGB* palette, int k);
+
+	//Iterative search with an explicit stack. seed is a palette index expected to be close (the result of the previous pixel),
+	//it only makes pruning start earlier. Ties give the lowest index so the result is the same as FindClosest, -1 with an empty palette
+	int FindClosest(const ColorRGB& color, int seed = -1) const
+	{
+		int best = -1;
+		int best_dist = INT_MAX;
+		if(seed >= 0)
+		{
+			best = seed;
+			best_dist = color.Dist(colors[seed]);
+		}
+
+		//Far sides left behind and the lower bound of their distance, at most one per level
+		int stack_node[64];
+		int stack_bound[64];
+		int top = 0;
+
+		int n = 0;
+		while(true)
+		{
+			const Node& node = nodes[n];
+			if(node.axis != FLATKDTREE_LEAF)
+			{
+				//Descend the near side, the far side is only needed if the split plane is close enough
+				int diff = color[node.axis] - node.split;
+				if(diff * diff <= best_dist)
+				{
+					stack_node[top] = diff < 0 ? node.right : n + 1;
+					stack_bound[top] = diff * diff;
+					top ++;
+				}
+				n = diff < 0 ? n + 1 : node.right;
+				continue;
+			}
+
+			const Entry* it = &entries[node.start];
+			const Entry* end = it + node.count;
+			for(; it != end; ++it)
+			{
+				int d = color.Dist(it->color);
+				if(d < best_dist || (d == best_dist && it->index < best))
+				{
+					best = it->index;
+					best_dist = d;
+				}
+			}
+
+			//Backtrack to the deepest far side that can still have a closer color
+			while(top > 0 && stack_bound[top - 1] > best_dist)
+				top --;
+			if(top == 0)
+				break;
+			n = stack_node[-- top];
+		}
+		return best;
+	}
+
+private:
+	int BuildR(Entry* begin, Entry* end);
+};
+
+#endif
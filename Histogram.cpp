@@ -0,0 +1,136 @@
+#include "Histogram.h"
+#include <cmath>
+#include <algorithm>
+
+#define INITIAL_BITS 12
+
+Histogram::Histogram()
+{
+	keys.assign(1 << INITIAL_BITS, HISTOGRAM_EMPTY_KEY);
+	counts.assign(1 << INITIAL_BITS, 0);
+	mask = (1 << INITIAL_BITS) - 1;
+	shift = 32 - INITIAL_BITS;
+	num_keys = 0;
+	num_pixels = 0;
+}
+
+Histogram::Histogram(const Image& image) : Histogram()
+{
+	AddImage(image);
+	Finish();
+}
+
+void Histogram::Clear()
+{
+	std::fill(keys.begin(), keys.end(), HISTOGRAM_EMPTY_KEY);
+	std::fill(counts.begin(), counts.end(), 0);
+	num_keys = 0;
+	num_pixels = 0;
+	entries.clear();
+}
+
+void Histogram::Grow()
+{
+	//The old table becomes the scratch one, so the memory of both is reused by the next growths and the next images
+	std::vector< unsigned int >& old_keys = scratch_keys;
+	std::vector< long long >& old_counts = scratch_counts;
+	old_keys.swap(keys);
+	old_counts.swap(counts);
+
+	keys.assign(old_keys.size() * 2, HISTOGRAM_EMPTY_KEY);
+	counts.assign(old_counts.size() * 2, 0);
+	mask = (unsigned int)keys.size() - 1;
+	shift --;
+
+	for(size_t i = 0; i < old_keys.size(); ++i)
+	{
+		if(old_keys[i] == HISTOGRAM_EMPTY_KEY)
+			continue;
+
+		unsigned int slot = Hash(old_keys[i]);
+		while(keys[slot] != HISTOGRAM_EMPTY_KEY)
+			slot = (slot + 1) & mask;
+		keys[slot] = old_keys[i];
+		counts[slot] = old_counts[i];
+	}
+}
+
+void Histogram::AddPixels(const unsigned char* data, int num_pixels, int depth)
+{
+	if(num_pixels == 0)
+		return;
+
+	//Runs of the same color are counted once
+	ColorRGB run_color(data[0], data[1], data[2]);
+	int run = 0;
+	for(int i = 0; i < num_pixels; ++i, data += depth)
+	{
+		if(data[0] == run_color.R && data[1] == run_color.G && data[2] == run_color.B)
+		{
+			run ++;
+		}
+		else
+		{
+			Add(run_color, run);
+			run_color.Set(data[0], data[1], data[2]);
+			run = 1;
+		}
+	}
+	Add(run_color, run);
+}
+
+void Histogram::AddImage(const Image& image)
+{
+	for(int y = 0; y < image.h; ++y)
+	{
+		AddPixels(image.data + image.GetIdx(0, y), image.w, image.depth);
+	}
+}
+
+void Histogram::AddStratified(const Image& image, long long max_pixels)
+{
+	double num_pixels = (double)image.w * image.h;
+	if(max_pixels <= 0 || num_pixels <= max_pixels)
+	{
+		AddImage(image);
+		return;
+	}
+
+	//Square cells so cols * rows <= max_pixels
+	double side = sqrt(num_pixels / max_pixels);
+	int cols = std::max(1, (int)(image.w / side));
+	int rows = std::max(1, (int)(max_pixels / cols));
+	rows = std::min(rows, image.h);
+	//At least one row, images much wider than max_pixels would go over it with every column
+	cols = (int)std::min((long long)cols, max_pixels / rows);
+
+	unsigned int random = 0x2545F491u;
+	for(int cy = 0; cy < rows; ++cy)
+	{
+		int y0 = (int)((long long)image.h * cy / rows);
+		int y1 = (int)((long long)image.h * (cy + 1) / rows);
+		for(int cx = 0; cx < cols; ++cx)
+		{
+			int x0 = (int)((long long)image.w * cx / cols);
+			int x1 = (int)((long long)image.w * (cx + 1) / cols);
+
+			random = random * 1664525u + 1013904223u;
+			int x = x0 + (int)((random >> 8) % (unsigned int)(x1 - x0));
+			random = random * 1664525u + 1013904223u;
+			int y = y0 + (int)((random >> 8) % (unsigned int)(y1 - y0));
+			Add(image.Get(x, y));
+		}
+	}
+}
+
+void Histogram::Finish()
+{
+	entries.clear();
+	entries.reserve(num_keys);
+	for(size_t i = 0; i < keys.size(); ++i)
+	{
+		unsigned int key = keys[i];
+		if(key != HISTOGRAM_EMPTY_KEY)
+			entries.push_back(HistogramEntry(ColorRGB(key & 0xFF, (key >> 8) & 0xFF, key >> 16), counts[i]));
+	}
+}
@@ -0,0 +1,83 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "Image.h"
+#include <vector>
+
+#define HISTOGRAM_EMPTY_KEY 0xFFFFFFFF
+
+class HistogramEntry
+{
+public:
+	ColorRGB color;
+	long long count;
+
+	HistogramEntry() {}
+	HistogramEntry(const ColorRGB& color, long long count) : color(color), count(count) {}
+};
+
+//Unique colors of an image with the number of pixels using them
+//Colors are counted in an open addressing table keyed by the 24 bit color and then collected into entries
+class Histogram
+{
+public:
+	std::vector< HistogramEntry > entries;
+	long long num_pixels;
+
+	Histogram();
+	Histogram(const Image& image);
+
+	//Removes all the colors keeping the table size, so images quantized one after another don't grow it again
+	void Clear();
+
+	void Add(const ColorRGB& color, long long count = 1)
+	{
+		unsigned int key = color.R | (color.G << 8) | (color.B << 16);
+		unsigned int slot = Hash(key);
+		while(keys[slot] != key)
+		{
+			if(keys[slot] == HISTOGRAM_EMPTY_KEY)
+			{
+				keys[slot] = key;
+				if(++ num_keys * 2 > keys.size())
+				{
+					Grow();
+					slot = Hash(key);
+					continue;
+				}
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+		counts[slot] += count;
+		num_pixels += count;
+	}
+
+	void AddPixels(const unsigned char* data, int num_pixels, int depth);
+	void AddImage(const Image& image);
+
+	//At most max_pixels pixels, one at a random position of each cell of a regular grid so every part of the image is represented
+	void AddStratified(const Image& image, long long max_pixels);
+
+	//Collects the table into entries, must be called before reading them
+	void Finish();
+
+private:
+	std::vector< unsigned int > keys;
+	std::vector< long long > counts; //64 bits, a streamed gigapixel image can have more than 2^32 pixels of one color
+	//Table before the last growth, its memory is reused by the next one
+	std::vector< unsigned int > scratch_keys;
+	std::vector< long long > scratch_counts;
+	unsigned int mask;
+	int shift;
+	size_t num_keys;
+
+	unsigned int Hash(unsigned int key) const
+	{
+		return (key * 2654435761u) >> shift;
+	}
+
+	void Grow();
+};
+
+#endif
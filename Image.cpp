@@ -1,5 +1,13 @@
 #include "Image.h"
 #include "KMeans.h"
+#include "NearestColor.h"
+#include "ThreadPool.h"
+#include "ErrorDiffusion.h"
+#include "IndexedImage.h"
+#include "BandMapper.h"
+#include "ImageStream.h"
+#include <atomic>
+#include <climits>
 
 int Clamp(int v, int min, int max)
 {
@@ -9,6 +17,61 @@ int Clamp(int v, int min, int max)
 	return v;
 }
 
+void FreeBuffer(unsigned char* data, BufferOwner owner)
+{
+	if(owner == Buffer_New)
+		delete[] data;
+	else if(owner == Buffer_STB)
+		stbi_image_free(data);
+}
+
+bool Image::Load(const char* path, int raw_w, int raw_h, int raw_depth)
+{
+	Free();
+
+	StreamReader reader;
+	if(!reader.Open(path, raw_w, raw_h, raw_depth))
+	{
+		data = stbi_load(path, &w, &h, &depth, 0);
+		owner = data ? Buffer_STB : Buffer_None;
+		return data != 0;
+	}
+
+	w = reader.w;
+	h = reader.h;
+	depth = reader.depth;
+	if(reader.format == Stream_Farbfeld)
+	{
+		data = new unsigned char[(size_t)w * h * depth];
+		owner = Buffer_New;
+		if(reader.ReadBand(*this) == h)
+			return true;
+		Free();
+		return false;
+	}
+
+	size_t offset = (size_t)reader.DataOffset();
+	reader.Close();
+	if(!file.Open(path, true) || file.size < offset + (size_t)w * h * depth)
+	{
+		file.Close();
+		return false;
+	}
+	data = file.Writable() + offset;
+	owner = Buffer_Mapped;
+	return true;
+}
+
+void Image::Free()
+{
+	if(owner == Buffer_Mapped)
+		file.Close();
+	else
+		FreeBuffer(data, owner);
+	data = 0;
+	owner = Buffer_None;
+}
+
 int FindClosest(const ColorRGB color, ColorRGB* pal, int pal_size)
 {
 	//Locate the closest centroid
@@ -26,35 +89,253 @@ int FindClosest(const ColorRGB color, ColorRGB* pal, int pal_size)
 	return best_k;
 }
 
-void Image::SetPalette(ColorRGB* palette, int k, bool dithering)
+//Only the kd-tree uses the previous result, the rest of finders ignore it
+template< class Finder >
+static inline int FindClosestSeeded(const Finder& finder, const ColorRGB& color, int)
 {
-	/*KDTree* kd_tree_nodes = new KDTree[k];
-	for(int c = 0; c < k; ++c) 
+	return finder.FindClosest(color);
+}
+
+static inline int FindClosestSeeded(const FlatKDTree& finder, const ColorRGB& color, int seed)
+{
+	return finder.FindClosest(color, seed);
+}
+
+//Mapped pixels are written to the image as palette colors or to an index plane
+class ColorOutput
+{
+public:
+	Image& img;
+	const ColorRGB* palette;
+
+	ColorOutput(Image& img, const ColorRGB* palette) : img(img), palette(palette) {}
+
+	void Put(int x, int y, int index) const
 	{
-		kd_tree_nodes[c].Reset(&palette[c], 0);
+		img.Set(x, y, palette[index]);
 	}
-	KDTree* kd_tree = KDTree::Build(kd_tree_nodes, kd_tree_nodes + k, 0);*/
+};
 
-	for(int y = 0; y < h; ++y)
+template< class T >
+class IndexOutput
+{
+public:
+	T* plane;
+	int w;
+
+	IndexOutput(T* plane, int w) : plane(plane), w(w) {}
+
+	void Put(int x, int y, int index) const
 	{
-		for(int x = 0; x < w; ++x)
+		plane[(size_t)y * w + x] = (T)index;
+	}
+};
+
+//last is the palette index of the previous pixel of the row, row is the row of the whole image when img is a band of it.
+//Only the pixel at x, y is read, so an index plane written in scan order can share the pixel buffer (indices are never bigger than pixels)
+template< class Finder, class Output >
+static void MapPixel(const Image& img, int x, int y, int row, const ColorRGB* palette, const Finder& finder, ErrorDiffusion* error, int& last, const Output& output)
+{
+	size_t idx = img.GetIdx(x, y);
+	ColorRGB color = error ? error->Get(x, row, img.data + idx) : ColorRGB(img.data[idx], img.data[idx + 1], img.data[idx + 2]);
+	last = FindClosestSeeded(finder, color, last);
+
+	//Apply dithering
+	if(error)
+		error->Diffuse(x, row, color, palette[last]);
+
+	output.Put(x, y, last);
+}
+
+//Maps the rows of img, which start at row first_row of the image. error keeps the dithering error of the rows before,
+//with a pool it must have pool->NumThreads() + 2 rows
+template< class Finder, class Output >
+static void MapRows(const Image& img, int first_row, const ColorRGB* palette, const Finder& finder, ErrorDiffusion* error, ThreadPool* pool, const Output& output)
+{
+	if(!pool || pool->NumThreads() == 1)
+	{
+		for(int y = 0; y < img.h; ++y)
 		{
-			ColorRGB& nearest_color = palette[FindClosest(Get(x, y), palette, k)];
-			//ColorRGB& nearest_color = *kd_tree->Nearest(Get(x, y))->color;
+			if(error)
+				error->StartRow(first_row + y);
 
-			//Apply dithering
-			if(dithering)
+			int last = -1;
+			for(int x = 0; x < img.w; ++x)
 			{
-				Vec3 quant_error = Get(x, y) - nearest_color;
-				Add(x + 1, y    , quant_error * (7.0f / 16.0f));
-				Add(x - 1, y + 1, quant_error * (3.0f / 16.0f));
-				Add(x    , y + 1, quant_error * (5.0f / 16.0f));
-				Add(x + 1, y + 1, quant_error * (1.0f / 16.0f));
+				MapPixel(img, x, y, first_row + y, palette, finder, error, last, output);
 			}
-
-			Set(x, y, nearest_color);
 		}
 	}
+	else
+	{
+		//Rows are interleaved between threads. With dithering each pixel waits until the previous row has mapped the pixel 2 columns to its right,
+		//at that point all the error it receives from that row has been added (diagonal wavefront) so the result is the same as the serial scan.
+		//The rows before img are complete when it starts
+		int num_tasks = pool->NumThreads();
+		std::vector< std::atomic< int > > progress(img.h);
+		for(int y = 0; y < img.h; ++y)
+			progress[y].store(0);
+
+		pool->Run(num_tasks, [&](int t)
+		{
+			for(int y = t; y < img.h; y += num_tasks)
+			{
+				if(error)
+					error->StartRow(first_row + y);
+
+				int available = 0;
+				int last = -1;
+				for(int x = 0; x < img.w; ++x)
+				{
+					if(error && y > 0)
+					{
+						int needed = std::min(x + 3, img.w);
+						while(available < needed)
+						{
+							available = progress[y - 1].load(std::memory_order_acquire);
+							if(available < needed)
+								std::this_thread::yield();
+						}
+					}
+
+					MapPixel(img, x, y, first_row + y, palette, finder, error, last, output);
 
-	//delete[] kd_tree_nodes;
-}
\ No newline at end of file
+					if((x & 15) == 15 || x == img.w - 1)
+						progress[y].store(x + 1, std::memory_order_release);
+				}
+			}
+		});
+	}
+}
+
+//Maps with the threads of pool when given, num_threads otherwise
+template< class Finder, class Output >
+static void MapImage(const Image& img, const ColorRGB* palette, const Finder& finder, bool dithering, int num_threads, ThreadPool* pool, const Output& output)
+{
+	if(pool)
+	{
+		ErrorDiffusion error(img.w, pool->NumThreads() + 2);
+		MapRows(img, 0, palette, finder, dithering ? &error : 0, pool, output);
+	}
+	else if(num_threads == 1)
+	{
+		ErrorDiffusion error(img.w);
+		MapRows(img, 0, palette, finder, dithering ? &error : 0, 0, output);
+	}
+	else
+	{
+		ThreadPool local_pool(num_threads);
+		ErrorDiffusion error(img.w, local_pool.NumThreads() + 2);
+		MapRows(img, 0, palette, finder, dithering ? &error : 0, &local_pool, output);
+	}
+}
+
+//num_queries is the number of pixels that will be mapped, img may be only a part of them
+static NearestBackend ChooseBackend(const Image& img, ColorRGB* palette, int k, NearestBackend backend, long long num_queries)
+{
+	if(backend != Nearest_Auto)
+		return backend;
+
+	//Pixels spread over the whole image to time the backends with
+	std::vector< ColorRGB > sample;
+	long long num_pixels = (long long)img.w * img.h;
+	long long step = std::max(1LL, num_pixels / 4096);
+	for(long long i = 0; i < num_pixels; i += step)
+		sample.push_back(ColorRGB(img.data[i * img.depth], img.data[i * img.depth + 1], img.data[i * img.depth + 2]));
+
+	return NearestTuner::Global().Choose(palette, k, sample.empty() ? 0 : &sample[0], (int)sample.size(), num_queries);
+}
+
+//Mapping with the backend selected in nearest
+template< class Output >
+static void MapNearest(const Image& img, const ColorRGB* palette, const NearestColor& nearest, bool dithering, int num_threads, ThreadPool* pool, const Output& output)
+{
+	switch(nearest.backend)
+	{
+		case Nearest_Scalar: MapImage(img, palette, nearest.scalar, dithering, num_threads, pool, output); break;
+		case Nearest_KDTree: MapImage(img, palette, nearest.kd_tree, dithering, num_threads, pool, output); break;
+		case Nearest_Grid:   MapImage(img, palette, nearest.grid, dithering, num_threads, pool, output); break;
+		case Nearest_LUT:    MapImage(img, palette, nearest.lut, dithering, num_threads, pool, output); break;
+		default:             MapImage(img, palette, nearest.simd, dithering, num_threads, pool, output); break;
+	}
+}
+
+template< class Output >
+static void MapNearest(const Image& img, const ColorRGB* palette, const ColorLUT& lut, bool dithering, int num_threads, ThreadPool* pool, const Output& output)
+{
+	MapImage(img, palette, lut, dithering, num_threads, pool, output);
+}
+
+//The plane takes over the pixel buffer when requested and the scan is serial, threads could overwrite pixels of rows not mapped yet.
+//Mapped files are only read so their pages aren't copied
+template< class Finder >
+static void MapIndexed(Image& img, const ColorRGB* palette, int k, const Finder& finder, bool dithering, int num_threads, ThreadPool* pool, IndexedImage& out, bool in_place)
+{
+	in_place = in_place && (pool ? pool->NumThreads() : num_threads) == 1 && img.owner != Buffer_Mapped;
+	out.Reset(img.w, img.h, palette, k, in_place ? img.data : 0, img.owner);
+
+	if(out.IndexSize() == 1)
+		MapNearest(img, palette, finder, dithering, num_threads, pool, IndexOutput< unsigned char >(out.Indices8(), img.w));
+	else
+		MapNearest(img, palette, finder, dithering, num_threads, pool, IndexOutput< unsigned short >(out.Indices16(), img.w));
+
+	if(in_place)
+	{
+		img.data = 0;
+		img.owner = Buffer_None;
+	}
+}
+
+//Builds the search structure in nearest, or in local when there is none to reuse
+static const NearestColor& BuildNearest(const Image& img, ColorRGB* palette, int k, NearestBackend backend, int num_threads, ThreadPool* pool, NearestColor* nearest, NearestColor& local)
+{
+	NearestColor& ret = nearest ? *nearest : local;
+	ret.Build(palette, k, ChooseBackend(img, palette, k, backend, (long long)img.w * img.h), pool ? pool->NumThreads() : num_threads);
+	return ret;
+}
+
+void Image::SetPalette(ColorRGB* palette, int k, bool dithering, int num_threads, NearestBackend backend, NearestColor* nearest, ThreadPool* pool)
+{
+	NearestColor local;
+	MapNearest(*this, palette, BuildNearest(*this, palette, k, backend, num_threads, pool, nearest, local), dithering, num_threads, pool, ColorOutput(*this, palette));
+}
+
+void Image::SetPalette(const ColorLUT& lut, bool dithering, int num_threads, ThreadPool* pool)
+{
+	MapImage(*this, &lut.palette[0], lut, dithering, lut.lazy ? 1 : num_threads, lut.lazy ? 0 : pool, ColorOutput(*this, &lut.palette[0]));
+}
+
+void Image::Map(ColorRGB* palette, int k, bool dithering, IndexedImage& out, int num_threads, NearestBackend backend, bool in_place, NearestColor* nearest, ThreadPool* pool)
+{
+	NearestColor local;
+	MapIndexed(*this, palette, k, BuildNearest(*this, palette, k, backend, num_threads, pool, nearest, local), dithering, num_threads, pool, out, in_place);
+}
+
+void Image::Map(const ColorLUT& lut, bool dithering, IndexedImage& out, int num_threads, bool in_place, ThreadPool* pool)
+{
+	MapIndexed(*this, &lut.palette[0], lut.k, lut, dithering, lut.lazy ? 1 : num_threads, lut.lazy ? 0 : pool, out, in_place);
+}
+
+BandMapper::BandMapper(ColorRGB* palette, int k, int w, int h, bool dithering, int num_threads, NearestBackend backend)
+	: palette(palette, palette + k), w(w), h(h), next_row(0), backend(backend), pool(num_threads), error(w, pool.NumThreads() + 2), dithering(dithering)
+{
+}
+
+void BandMapper::SetPalette(Image& band)
+{
+	//The backend is chosen with the first band
+	if(next_row == 0)
+		nearest.Build(&palette[0], (int)palette.size(), ChooseBackend(band, &palette[0], (int)palette.size(), backend, (long long)w * h), pool.NumThreads());
+
+	ColorOutput output(band, &palette[0]);
+	ErrorDiffusion* band_error = dithering ? &error : 0;
+	switch(nearest.backend)
+	{
+		case Nearest_Scalar: MapRows(band, next_row, &palette[0], nearest.scalar, band_error, &pool, output); break;
+		case Nearest_KDTree: MapRows(band, next_row, &palette[0], nearest.kd_tree, band_error, &pool, output); break;
+		case Nearest_Grid:   MapRows(band, next_row, &palette[0], nearest.grid, band_error, &pool, output); break;
+		case Nearest_LUT:    MapRows(band, next_row, &palette[0], nearest.lut, band_error, &pool, output); break;
+		default:             MapRows(band, next_row, &palette[0], nearest.simd, band_error, &pool, output); break;
+	}
+	next_row += band.h;
+}
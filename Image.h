@@ -4,6 +4,7 @@
 #include "stb_image.h"
 #include "stb_image_write.h"
 #include "stb_image_resize.h"
+#include "MappedFile.h"
 
 int Clamp(int v, int min, int max);
 
@@ -63,8 +64,8 @@ public:
 class Group
 {
 public:
-	float color[3];
-	int n;
+	long long color[3];
+	long long n;
 
 	Group() 
 	{
@@ -73,61 +74,128 @@ public:
 	
 	void Clear()
 	{
-		color[0] = color[1] = color[2] = 0.0f;
+		color[0] = color[1] = color[2] = 0;
 		n = 0;
 	}
 
-	void Add(const ColorRGB& color)
+	void Add(const ColorRGB& color, long long count = 1)
 	{
-		this->color[0] += color.R;
-		this->color[1] += color.G;
-		this->color[2] += color.B;
+		this->color[0] += (long long)color.R * count;
+		this->color[1] += (long long)color.G * count;
+		this->color[2] += (long long)color.B * count;
 		
-		n++;
+		n += count;
 	}
+
+	void Add(const Group& other)
+	{
+		color[0] += other.color[0];
+		color[1] += other.color[1];
+		color[2] += other.color[2];
+		n += other.n;
+	}
+
+	//Rounded to the nearest level, truncating biases every centroid towards black and lets kmeans cycle between neighbour levels
+	ColorRGB Mean() const
+	{
+		return ColorRGB((unsigned char)((color[0] + n / 2) / n), (unsigned char)((color[1] + n / 2) / n), (unsigned char)((color[2] + n / 2) / n));
+	}
+};
+
+class ColorLUT;
+class IndexedImage;
+class NearestColor;
+class ThreadPool;
+
+//Ways of finding the closest palette color, all of them give exactly the same result as FindClosest
+enum NearestBackend
+{
+	Nearest_Scalar,
+	Nearest_SIMD,
+	Nearest_KDTree,
+	Nearest_Grid,
+	Nearest_LUT,
+	Nearest_Auto //Measures the others and takes the fastest
+};
+
+//How a pixel buffer was allocated, it must be released the same way
+enum BufferOwner
+{
+	Buffer_None,   //Not owned
+	Buffer_New,    //new[]
+	Buffer_STB,    //stbi_load
+	Buffer_Mapped  //Pages of a file mapped in memory, released with the mapping
 };
 
+//Releases heap buffers, mapped ones are released by their MappedFile
+void FreeBuffer(unsigned char* data, BufferOwner owner);
+
 class Image
 {
 public:
 	int w, h, depth;
 	unsigned char* data;
+	BufferOwner owner;
+
+	Image() : w(0), h(0), depth(0), data(0), owner(Buffer_None) {}
+
+	//See Load
+	Image(const char* path, int raw_w = 0, int raw_h = 0, int raw_depth = 3) : w(0), h(0), depth(0), data(0), owner(Buffer_None)
+	{
+		Load(path, raw_w, raw_h, raw_depth);
+	}
+
+	Image(int w, int h, int depth) : w(w), h(h), depth(depth), owner(Buffer_New)
+	{
+		data = new unsigned char[(size_t)w * h * depth];
+	}
 
-	Image(const char* path) 
+	//Copy of source scaled to new_w x new_h
+	Image(const Image& source, int new_w, int new_h) : w(new_w), h(new_h), depth(source.depth), owner(Buffer_New)
 	{
-		data = stbi_load(path, &w, &h, &depth, 0);
+		data = new unsigned char[(size_t)w * h * depth];
+		stbir_resize_uint8(source.data, source.w, source.h, 0, data, w, h, 0, depth);
 	}
 
 	~Image()
 	{
-		delete[] data;
+		Free();
 	}
 
+	//PPM, PAM and raw files (8 bits, size given by raw_w, raw_h and raw_depth) are mapped copy-on-write and used in place without decoding,
+	//pages are only copied when written. Farbfeld is converted to 8 bits and the rest of formats are decoded by stb
+	bool Load(const char* path, int raw_w = 0, int raw_h = 0, int raw_depth = 3);
+
+	//Releases the pixels, data is 0 after it
+	void Free();
+
 	void Resize(int new_w, int new_h)
 	{
-		unsigned char* new_data = new unsigned char[new_w * new_h * depth];
+		unsigned char* new_data = new unsigned char[(size_t)new_w * new_h * depth];
 		stbir_resize_uint8(data, w, h, 0, new_data, new_w, new_h, 0, depth);
 
-		delete[] data;
+		Free();
+		owner = Buffer_New;
 		data = new_data;
 		w = new_w;
 		h = new_h;
 	}
 
-	int GetIdx(int x, int y) const
+	//Mapped images can be bigger than 2GB
+	size_t GetIdx(int x, int y) const
 	{
-		return (w * y + x) * depth;
+		return ((size_t)w * y + x) * depth;
 	}
 
 	ColorRGB Get(int x, int y) const
 	{
-		int idx = GetIdx(x, y);
+		size_t idx = GetIdx(x, y);
 		return ColorRGB(data[idx], data[idx + 1], data[idx + 2]);
 	}
 
 	void Set(int x, int y, const ColorRGB& color)
 	{
-		int idx = GetIdx(x, y);
+		size_t idx = GetIdx(x, y);
 		data[idx    ] = color.R;
 		data[idx + 1] = color.G;
 		data[idx + 2] = color.B;
@@ -135,21 +203,34 @@ public:
 
 	void Add(int x, int y, const Vec3& error)
 	{
-		if(x < w && y < h)
+		if(x >= 0 && x < w && y < h)
 		{
-			int idx = GetIdx(x, y);
+			size_t idx = GetIdx(x, y);
 			data[idx    ] = Clamp(data[idx    ] + error.X, 0, 255);
 			data[idx + 1] = Clamp(data[idx + 1] + error.Y, 0, 255);
 			data[idx + 2] = Clamp(data[idx + 2] + error.Z, 0, 255);
 		}
 	}
 
-	void SetPalette(ColorRGB* palette, int k, bool dithering);
+	//Replaces every pixel by its palette color
+	//Dithering with several threads gives the same result than with one, and every backend gives the same result.
+	//Callers mapping one image after another can pass the search structure and the threads to reuse, pool replaces num_threads when given
+	void SetPalette(ColorRGB* palette, int k, bool dithering, int num_threads = 1, NearestBackend backend = Nearest_Auto, NearestColor* nearest = 0, ThreadPool* pool = 0);
+	//With a table already built or loaded for its palette, lazy tables always map with one thread
+	void SetPalette(const ColorLUT& lut, bool dithering, int num_threads = 1, ThreadPool* pool = 0);
+
+	//Same mapping as SetPalette but the palette indices go to out and the pixels aren't modified.
+	//With in_place, one thread and a heap buffer (not a mapped file) out takes the pixel buffer as its index plane and the image is left without data
+	void Map(ColorRGB* palette, int k, bool dithering, IndexedImage& out, int num_threads = 1, NearestBackend backend = Nearest_Auto, bool in_place = false, NearestColor* nearest = 0, ThreadPool* pool = 0);
+	void Map(const ColorLUT& lut, bool dithering, IndexedImage& out, int num_threads = 1, bool in_place = false, ThreadPool* pool = 0);
 
 	void Save(const char* path)
 	{
 		stbi_write_png(path, w, h, depth, data, 0);
 	}
+
+private:
+	MappedFile file;
 };
 
 int FindClosest(const ColorRGB color, ColorRGB* pal, int pal_size);
@@ -0,0 +1,415 @@
+#include "ImageStream.h"
+#include "IndexedImage.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+StreamFormat StreamFormatFromPath(const char* path)
+{
+	const char* dot = strrchr(path, '.');
+	if(!dot)
+		return Stream_None;
+
+	char ext[8] = {0};
+	for(int i = 0; i < 7 && dot[i + 1]; ++i)
+		ext[i] = (char)tolower(dot[i + 1]);
+
+	if(!strcmp(ext, "ppm"))
+		return Stream_PPM;
+	if(!strcmp(ext, "pam"))
+		return Stream_PAM;
+	if(!strcmp(ext, "raw"))
+		return Stream_Raw;
+	if(!strcmp(ext, "ff"))
+		return Stream_Farbfeld;
+	if(!strcmp(ext, "idx"))
+		return Stream_Indices;
+	return Stream_None;
+}
+
+std::string StreamHeader(StreamFormat format, int w, int h, int depth)
+{
+	char header[256];
+	if(format == Stream_PPM)
+	{
+		sprintf(header, "P6\n%d %d\n255\n", w, h);
+	}
+	else if(format == Stream_PAM)
+	{
+		sprintf(header, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", w, h, depth, depth == 4 ? "RGB_ALPHA" : "RGB");
+	}
+	else if(format == Stream_Farbfeld)
+	{
+		memcpy(header, "farbfeld", 8);
+		for(int i = 0; i < 4; ++i)
+		{
+			header[8 + i] = (char)(w >> (24 - i * 8));
+			header[12 + i] = (char)(h >> (24 - i * 8));
+		}
+		return std::string(header, 16);
+	}
+	else
+	{
+		return std::string();
+	}
+	return header;
+}
+
+//Depth of the pixels as stored in the file
+static int FileDepth(StreamFormat format, int depth)
+{
+	if(format == Stream_PPM)
+		return 3;
+	if(format == Stream_Farbfeld)
+		return 4;
+	return depth;
+}
+
+//Bytes per pixel in the file
+static int FilePixelSize(StreamFormat format, int depth)
+{
+	return format == Stream_Farbfeld ? 8 : FileDepth(format, depth);
+}
+
+//One row of 8 bit pixels of depth src_depth into the file layout
+static void ConvertRow(const unsigned char* src, int src_depth, unsigned char* dst, StreamFormat format, int depth, int w)
+{
+	int dst_depth = FileDepth(format, depth);
+	for(int x = 0; x < w; ++x, src += src_depth)
+	{
+		unsigned char alpha = src_depth == 4 ? src[3] : 255;
+		if(format == Stream_Farbfeld)
+		{
+			for(int c = 0; c < 4; ++c)
+			{
+				dst[c * 2] = dst[c * 2 + 1] = c == 3 ? alpha : src[c];
+			}
+			dst += 8;
+			continue;
+		}
+
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		if(dst_depth == 4)
+			dst[3] = alpha;
+		dst += dst_depth;
+	}
+}
+
+//Next number of a PPM header, skipping whitespace and comments
+static bool ReadPPMNumber(FILE* file, int& value)
+{
+	int c = fgetc(file);
+	while(c != EOF && (isspace(c) || c == '#'))
+	{
+		if(c == '#')
+		{
+			while(c != EOF && c != '\n')
+				c = fgetc(file);
+		}
+		c = fgetc(file);
+	}
+
+	if(!isdigit(c))
+		return false;
+
+	value = 0;
+	while(isdigit(c))
+	{
+		value = value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+	//One whitespace character ends the number, after maxval it's the last byte of the header
+	return isspace(c) != 0;
+}
+
+static bool ReadPAMHeader(FILE* file, int& w, int& h, int& depth)
+{
+	int maxval = 0;
+	w = h = depth = 0;
+
+	char line[256];
+	while(fgets(line, sizeof(line), file))
+	{
+		char key[32];
+		int value;
+		if(sscanf(line, "%31s", key) != 1 || key[0] == '#')
+			continue;
+		if(!strcmp(key, "ENDHDR"))
+			return w > 0 && h > 0 && (depth == 3 || depth == 4) && maxval == 255;
+
+		if(sscanf(line, "%31s %d", key, &value) != 2)
+			continue;
+		if(!strcmp(key, "WIDTH"))
+			w = value;
+		else if(!strcmp(key, "HEIGHT"))
+			h = value;
+		else if(!strcmp(key, "DEPTH"))
+			depth = value;
+		else if(!strcmp(key, "MAXVAL"))
+			maxval = value;
+	}
+	return false;
+}
+
+StreamReader::StreamReader() : w(0), h(0), depth(0), format(Stream_None), file(0), data_offset(0), next_row(0)
+{
+}
+
+StreamReader::~StreamReader()
+{
+	Close();
+}
+
+bool StreamReader::Open(const char* path, int raw_w, int raw_h, int raw_depth)
+{
+	Close();
+	format = StreamFormatFromPath(path);
+	if(format == Stream_None || format == Stream_Indices)
+		return false;
+
+	file = fopen(path, "rb");
+	if(!file)
+		return false;
+
+	bool ok = false;
+	if(format == Stream_Raw)
+	{
+		w = raw_w;
+		h = raw_h;
+		depth = raw_depth;
+		ok = w > 0 && h > 0 && (depth == 3 || depth == 4);
+	}
+	else
+	{
+		char magic[3] = {0};
+		ok = fread(magic, 1, 2, file) == 2;
+		if(ok && format == Stream_PPM)
+		{
+			int maxval = 0;
+			depth = 3;
+			ok = !strcmp(magic, "P6") && ReadPPMNumber(file, w) && ReadPPMNumber(file, h) && ReadPPMNumber(file, maxval) && maxval == 255;
+		}
+		else if(ok && format == Stream_PAM)
+		{
+			ok = !strcmp(magic, "P7") && ReadPAMHeader(file, w, h, depth);
+		}
+		else if(ok)
+		{
+			unsigned char header[14];
+			ok = format == Stream_Farbfeld && fread(header, 1, 14, file) == 14 && !strncmp(magic, "fa", 2) && !memcmp(header, "rbfeld", 6);
+			w = (header[6] << 24) | (header[7] << 16) | (header[8] << 8) | header[9];
+			h = (header[10] << 24) | (header[11] << 16) | (header[12] << 8) | header[13];
+			depth = 4;
+			ok = ok && w > 0 && h > 0;
+		}
+	}
+
+	if(!ok)
+	{
+		Close();
+		return false;
+	}
+	data_offset = ftell(file);
+	next_row = 0;
+	return true;
+}
+
+void StreamReader::Close()
+{
+	if(file)
+		fclose(file);
+	file = 0;
+}
+
+int StreamReader::ReadBand(Image& band)
+{
+	int rows = std::min(band.h, h - next_row);
+	if(!file || rows <= 0 || band.w != w || band.depth != depth)
+	{
+		band.h = 0;
+		return 0;
+	}
+
+	if(format == Stream_Farbfeld)
+	{
+		//16 bit channels rounded to 8 bits
+		row.resize((size_t)w * 8);
+		for(int y = 0; y < rows; ++y)
+		{
+			if(fread(&row[0], 1, row.size(), file) != row.size())
+			{
+				rows = y;
+				break;
+			}
+			unsigned char* dst = band.data + band.GetIdx(0, y);
+			for(int i = 0; i < w * 4; ++i)
+				dst[i] = (unsigned char)((((row[i * 2] << 8) | row[i * 2 + 1]) + 128) / 257);
+		}
+	}
+	else
+	{
+		rows = (int)(fread(band.data, (size_t)w * depth, rows, file));
+	}
+	next_row += rows;
+	band.h = rows;
+	return rows;
+}
+
+bool StreamReader::Rewind()
+{
+	if(!file || fseek(file, data_offset, SEEK_SET) != 0)
+		return false;
+	next_row = 0;
+	return true;
+}
+
+StreamWriter::StreamWriter() : file(0), format(Stream_None), w(0), h(0), depth(0), next_row(0)
+{
+}
+
+StreamWriter::~StreamWriter()
+{
+	Close();
+}
+
+bool StreamWriter::Open(const char* path, StreamFormat format, int w, int h, int depth)
+{
+	Close();
+	if(format == Stream_None || format == Stream_Indices || w <= 0 || h <= 0)
+		return false;
+
+	file = fopen(path, "wb");
+	if(!file)
+		return false;
+
+	this->format = format;
+	this->w = w;
+	this->h = h;
+	this->depth = FileDepth(format, depth);
+	next_row = 0;
+
+	std::string header = StreamHeader(format, w, h, this->depth);
+	if(!header.empty() && fwrite(header.data(), 1, header.size(), file) != header.size())
+	{
+		fclose(file);
+		file = 0;
+		return false;
+	}
+	return true;
+}
+
+bool StreamWriter::Close()
+{
+	if(!file)
+		return false;
+
+	bool ok = fclose(file) == 0 && next_row == h;
+	file = 0;
+	return ok;
+}
+
+bool StreamWriter::WriteBand(const Image& band)
+{
+	if(!file || band.w != w || next_row + band.h > h)
+		return false;
+
+	size_t row_size = (size_t)w * FilePixelSize(format, depth);
+	if(band.depth == depth && format != Stream_Farbfeld)
+	{
+		if(fwrite(band.data, row_size, band.h, file) != (size_t)band.h)
+			return false;
+		next_row += band.h;
+		return true;
+	}
+
+	row.resize(row_size);
+	for(int y = 0; y < band.h; ++y)
+	{
+		ConvertRow(band.data + band.GetIdx(0, y), band.depth, &row[0], format, depth, w);
+		if(fwrite(&row[0], 1, row_size, file) != row_size)
+			return false;
+		next_row ++;
+	}
+	return true;
+}
+
+bool WriteMapped(const char* path, StreamFormat format, const Image& img)
+{
+	if(format == Stream_None || format == Stream_Indices)
+		return false;
+
+	std::string header = StreamHeader(format, img.w, img.h, img.depth);
+	size_t row_size = (size_t)img.w * FilePixelSize(format, img.depth);
+	MappedFile file;
+	if(!file.Create(path, header.size() + row_size * img.h))
+		return false;
+
+	unsigned char* out = file.Writable();
+	memcpy(out, header.data(), header.size());
+	out += header.size();
+	if(FileDepth(format, img.depth) == img.depth && format != Stream_Farbfeld)
+	{
+		memcpy(out, img.data, row_size * img.h);
+		return true;
+	}
+
+	for(int y = 0; y < img.h; ++y)
+		ConvertRow(img.data + img.GetIdx(0, y), img.depth, out + row_size * y, format, img.depth, img.w);
+	return true;
+}
+
+bool WriteMapped(const char* path, StreamFormat format, const IndexedImage& img, int depth)
+{
+	if(format == Stream_None)
+		return false;
+
+	size_t num_pixels = (size_t)img.w * img.h;
+	MappedFile file;
+	if(format == Stream_Indices)
+	{
+		if(!file.Create(path, num_pixels * img.IndexSize()))
+			return false;
+
+		if(img.IndexSize() == 1)
+		{
+			memcpy(file.Writable(), img.Indices8(), num_pixels);
+		}
+		else
+		{
+			unsigned char* out = file.Writable();
+			const unsigned short* indices = img.Indices16();
+			for(size_t i = 0; i < num_pixels; ++i)
+			{
+				out[i * 2] = (unsigned char)indices[i];
+				out[i * 2 + 1] = (unsigned char)(indices[i] >> 8);
+			}
+		}
+		return true;
+	}
+
+	//Palette colors in the file layout, then every pixel is one copy
+	int pixel_size = FilePixelSize(format, depth);
+	std::vector< unsigned char > colors(img.palette.size() * pixel_size);
+	for(size_t c = 0; c < img.palette.size(); ++c)
+	{
+		unsigned char rgba[4] = { img.palette[c].R, img.palette[c].G, img.palette[c].B, 255 };
+		ConvertRow(rgba, 4, &colors[c * pixel_size], format, depth, 1);
+	}
+
+	std::string header = StreamHeader(format, img.w, img.h, FileDepth(format, depth));
+	if(!file.Create(path, header.size() + num_pixels * pixel_size))
+		return false;
+
+	unsigned char* out = file.Writable();
+	memcpy(out, header.data(), header.size());
+	out += header.size();
+	for(size_t i = 0; i < num_pixels; ++i, out += pixel_size)
+	{
+		int index = img.IndexSize() == 1 ? img.Indices8()[i] : img.Indices16()[i];
+		memcpy(out, &colors[index * pixel_size], pixel_size);
+	}
+	return true;
+}
@@ -0,0 +1,95 @@
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include "Image.h"
+#include <cstdio>
+#include <vector>
+#include <string>
+
+//Uncompressed formats that can be read and written one band of rows at a time
+enum StreamFormat
+{
+	Stream_PPM,  //Binary P6, 8 bits
+	Stream_PAM,  //P7 with depth 3 (RGB) or 4 (RGB_ALPHA), 8 bits
+	Stream_Raw,       //Interleaved 8 bit pixels without header, the size is given apart
+	Stream_Farbfeld,  //RGBA with 16 bit big endian channels, converted from and to 8 bits
+	Stream_Indices,   //Palette indices without header, 1 byte per pixel up to 256 colors and 2 (little endian) otherwise. Output only
+	Stream_None
+};
+
+class IndexedImage;
+
+//By extension (.ppm, .pam, .raw, .ff or .idx), Stream_None for the rest
+StreamFormat StreamFormatFromPath(const char* path);
+
+//Header of the format, empty for raw data
+std::string StreamHeader(StreamFormat format, int w, int h, int depth);
+
+//Writes the whole image into an output file sized and mapped beforehand, pixels are copied without encoding.
+//An IndexedImage is expanded to its palette colors straight into the file, or written as indices with Stream_Indices
+bool WriteMapped(const char* path, StreamFormat format, const Image& img);
+bool WriteMapped(const char* path, StreamFormat format, const IndexedImage& img, int depth = 3);
+
+//Reads an image a band of rows at a time, the file can be bigger than the memory
+class StreamReader
+{
+public:
+	int w, h, depth;
+	StreamFormat format;
+
+	StreamReader();
+	~StreamReader();
+
+	//Raw files take their size from raw_w, raw_h and raw_depth
+	bool Open(const char* path, int raw_w = 0, int raw_h = 0, int raw_depth = 3);
+	void Close();
+
+	//Reads up to band.h rows into band (w pixels wide, same depth), band.h is set to the rows read (0 at the end)
+	int ReadBand(Image& band);
+
+	//Back to the first row, for another pass
+	bool Rewind();
+
+	//Position of the first pixel in the file
+	long DataOffset() const
+	{
+		return data_offset;
+	}
+
+private:
+	FILE* file;
+	long data_offset;
+	int next_row;
+	std::vector< unsigned char > row;
+
+	StreamReader(const StreamReader&);
+	StreamReader& operator=(const StreamReader&);
+};
+
+//Writes an image a band of rows at a time
+class StreamWriter
+{
+public:
+	StreamWriter();
+	~StreamWriter();
+
+	//PPM files are always written with depth 3 and farbfeld files with depth 4
+	bool Open(const char* path, StreamFormat format, int w, int h, int depth);
+	//Fails if not all the rows were written
+	bool Close();
+
+	//Writes the band.h rows of band, the alpha channel is dropped or set opaque if the depths don't match
+	bool WriteBand(const Image& band);
+
+private:
+	FILE* file;
+	StreamFormat format;
+	int w, h, depth;
+	int next_row;
+	std::vector< unsigned char > row;
+
+	StreamWriter(const StreamWriter&);
+	StreamWriter& operator=(const StreamWriter&);
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef INDEXEDIMAGE_H
+#define INDEXEDIMAGE_H
+
+#include "Image.h"
+#include <vector>
+
+//Result of mapping an image to a palette: the palette plus one index per pixel, 1 byte for palettes up to 256 colors and 2 bytes otherwise
+class IndexedImage
+{
+public:
+	int w, h;
+	std::vector< ColorRGB > palette;
+	unsigned char* data;
+	BufferOwner owner;
+	size_t capacity; //Bytes of data
+
+	IndexedImage() : w(0), h(0), data(0), owner(Buffer_None), capacity(0) {}
+
+	~IndexedImage()
+	{
+		FreeBuffer(data, owner);
+	}
+
+	//Takes buffer, a heap buffer allocated as given by buffer_owner with room for w * h indices, as the index plane.
+	//0 keeps the current plane if it was allocated here and is big enough, so images mapped one after another share it
+	void Reset(int w, int h, const ColorRGB* palette, int k, unsigned char* buffer = 0, BufferOwner buffer_owner = Buffer_New)
+	{
+		this->w = w;
+		this->h = h;
+		this->palette.assign(palette, palette + k);
+		size_t size = (size_t)w * h * IndexSize();
+		if(!buffer && owner == Buffer_New && capacity >= size)
+			return;
+
+		FreeBuffer(data, owner);
+		data = buffer ? buffer : new unsigned char[size];
+		owner = buffer ? buffer_owner : Buffer_New;
+		capacity = size;
+	}
+
+	int IndexSize() const
+	{
+		return palette.size() <= 256 ? 1 : 2;
+	}
+
+	unsigned char* Indices8() const
+	{
+		return data;
+	}
+
+	unsigned short* Indices16() const
+	{
+		return (unsigned short*)data;
+	}
+
+	int Get(int x, int y) const
+	{
+		size_t i = (size_t)y * w + x;
+		return IndexSize() == 1 ? Indices8()[i] : Indices16()[i];
+	}
+
+private:
+	IndexedImage(const IndexedImage&);
+	IndexedImage& operator=(const IndexedImage&);
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "InverseColormap.h"
+#include <cstdlib>
+#include <algorithm>
+
+void InverseColormap::Build(const ColorRGB* palette, int k)
+{
+	const int cells_per_axis = 1 << INVERSE_COLORMAP_BITS;
+	const int cell_size = 256 / cells_per_axis;
+
+	//Squared min and max distances along each axis from every cell range to every entry
+	std::vector< int > min_axis(3 * cells_per_axis * k);
+	std::vector< int > max_axis(3 * cells_per_axis * k);
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		for(int i = 0; i < cells_per_axis; ++i)
+		{
+			int lo = i * cell_size;
+			int hi = lo + cell_size - 1;
+			for(int c = 0; c < k; ++c)
+			{
+				int v = palette[c][axis];
+				int d_min = v < lo ? lo - v : (v > hi ? v - hi : 0);
+				int d_max = std::max(std::abs(v - lo), std::abs(v - hi));
+				min_axis[(axis * cells_per_axis + i) * k + c] = d_min * d_min;
+				max_axis[(axis * cells_per_axis + i) * k + c] = d_max * d_max;
+			}
+		}
+	}
+
+	cell_start.resize(cells_per_axis * cells_per_axis * cells_per_axis + 1);
+	candidates.clear();
+
+	std::vector< int > min_dist(k);
+	int cell = 0;
+	for(int r = 0; r < cells_per_axis; ++r)
+	{
+		const int* min_r = &min_axis[(0 * cells_per_axis + r) * k];
+		const int* max_r = &max_axis[(0 * cells_per_axis + r) * k];
+		for(int g = 0; g < cells_per_axis; ++g)
+		{
+			const int* min_g = &min_axis[(1 * cells_per_axis + g) * k];
+			const int* max_g = &max_axis[(1 * cells_per_axis + g) * k];
+			for(int b = 0; b < cells_per_axis; ++b, ++cell)
+			{
+				const int* min_b = &min_axis[(2 * cells_per_axis + b) * k];
+				const int* max_b = &max_axis[(2 * cells_per_axis + b) * k];
+
+				int threshold = INT_MAX;
+				for(int c = 0; c < k; ++c)
+				{
+					min_dist[c] = min_r[c] + min_g[c] + min_b[c];
+					threshold = std::min(threshold, max_r[c] + max_g[c] + max_b[c]);
+				}
+
+				cell_start[cell] = (unsigned int)candidates.size();
+				for(int c = 0; c < k; ++c)
+				{
+					if(min_dist[c] <= threshold)
+					{
+						Candidate candidate;
+						candidate.color = palette[c];
+						candidate.index = (unsigned short)c;
+						candidates.push_back(candidate);
+					}
+				}
+			}
+		}
+	}
+	cell_start[cell] = (unsigned int)candidates.size();
+}
@@ -0,0 +1,50 @@
+#ifndef INVERSECOLORMAP_H
+#define INVERSECOLORMAP_H
+
+#include "Image.h"
+#include <vector>
+#include <climits>
+
+#define INVERSE_COLORMAP_BITS 5
+
+//Coarse RGB grid where each cell keeps the palette entries that can be the closest to any color inside it
+//An entry is kept if its minimum distance to the cell is not greater than the smallest maximum distance of any entry,
+//candidates are in palette order so the lookup gives exactly the same result as FindClosest
+class InverseColormap
+{
+public:
+	class Candidate
+	{
+	public:
+		ColorRGB color;
+		unsigned short index;
+	};
+
+	std::vector< unsigned int > cell_start;
+	std::vector< Candidate > candidates;
+
+	void Build(const ColorRGB* palette, int k);
+
+	int FindClosest(const ColorRGB& color) const
+	{
+		const int shift = 8 - INVERSE_COLORMAP_BITS;
+		int cell = ((color.R >> shift) << (2 * INVERSE_COLORMAP_BITS)) | ((color.G >> shift) << INVERSE_COLORMAP_BITS) | (color.B >> shift);
+
+		const Candidate* it = &candidates[cell_start[cell]];
+		const Candidate* end = &candidates[0] + cell_start[cell + 1];
+		int min_dist = INT_MAX;
+		int best_k = 0;
+		for(; it != end; ++it)
+		{
+			int d = color.Dist(it->color);
+			if(d < min_dist)
+			{
+				best_k = it->index;
+				min_dist = d;
+			}
+		}
+		return best_k;
+	}
+};
+
+#endif
@@ -1,42 +1,271 @@
 #include "KMeans.h"
 #include "Octree.h"
+#include "NearestColor.h"
+#include "ThreadPool.h"
+#include "Stats.h"
+#include <cmath>
+#include <cfloat>
+#include <new>
 
-ColorRGB* KMeans(const Image& img, int k)
+#define CACHE_LINE 64
+
+//Brute force search of the closest and second closest centroids
+static int FindClosest2(const ColorRGB& color, const ColorRGB* centroids, int k, float& dist0, float& dist1)
 {
-	//Initialize palette using octree method
-	ColorRGB* ret = OctreePalette(img, k);
+	int min_dist0 = INT_MAX;
+	int min_dist1 = INT_MAX;
+	int best_k = 0;
+	for(int c = 0; c < k; ++c)
+	{
+		int d = color.Dist(centroids[c]);
+		if(d < min_dist0)
+		{
+			min_dist1 = min_dist0;
+			min_dist0 = d;
+			best_k = c;
+		}
+		else if(d < min_dist1)
+		{
+			min_dist1 = d;
+		}
+	}
+
+	dist0 = sqrtf((float)min_dist0);
+	dist1 = k > 1 ? sqrtf((float)min_dist1) : FLT_MAX;
+	return best_k;
+}
+
+//Hamerly's bounds for the bounded mode, kept in the buffers
+class KMeansBounds
+{
+public:
+	int* assignment; //Current centroid of each color
+	float* upper;    //Upper bound of the distance to the assigned centroid
+	float* lower;    //Lower bound of the distance to any other centroid
+	float* half_min_dist; //Half the distance from each centroid to its closest centroid
+	float* drift;
+
+	//Starts the bounds of n colors in the memory of the buffers
+	void Reset(int n, int k, KMeansBuffers& buffers)
+	{
+		//Forces a full search on the first iteration
+		buffers.assignment.assign(n, 0);
+		buffers.upper.assign(n, FLT_MAX);
+		buffers.lower.assign(n, 0.0f);
+		buffers.half_min_dist.resize(k);
+		buffers.drift.resize(k);
+
+		assignment = buffers.assignment.data();
+		upper = buffers.upper.data();
+		lower = buffers.lower.data();
+		half_min_dist = buffers.half_min_dist.data();
+		drift = buffers.drift.data();
+	}
+
+	void UpdateCentroidDistances(const ColorRGB* centroids, int k)
+	{
+		for(int c = 0; c < k; ++c)
+		{
+			int min_dist = INT_MAX;
+			for(int c2 = 0; c2 < k; ++c2)
+			{
+				if(c2 != c)
+					min_dist = std::min(min_dist, centroids[c].Dist(centroids[c2]));
+			}
+			half_min_dist[c] = k > 1 ? 0.5f * sqrtf((float)min_dist) : FLT_MAX;
+		}
+	}
+
+	int Assign(int i, const ColorRGB& color, const ColorRGB* centroids, int k)
+	{
+		int a = assignment[i];
+		float bound = std::max(half_min_dist[a], lower[i]);
+		if(upper[i] > bound)
+		{
+			//Tighten the upper bound and check again before doing the full search
+			upper[i] = sqrtf((float)color.Dist(centroids[a]));
+			if(upper[i] > bound)
+			{
+				a = FindClosest2(color, centroids, k, upper[i], lower[i]);
+				assignment[i] = a;
+			}
+		}
+		return a;
+	}
+
+	void UpdateBounds(int n, int k)
+	{
+		//Other centroids can get closer at most by the largest drift (the second largest for the one that moved most)
+		int max_c = 0;
+		for(int c = 1; c < k; ++c)
+		{
+			if(drift[c] > drift[max_c])
+				max_c = c;
+		}
+		float second_drift = 0.0f;
+		for(int c = 0; c < k; ++c)
+		{
+			if(c != max_c && drift[c] > second_drift)
+				second_drift = drift[c];
+		}
+
+		for(int i = 0; i < n; ++i)
+		{
+			int a = assignment[i];
+			upper[i] += drift[a];
+			lower[i] -= a == max_c ? second_drift : drift[max_c];
+		}
+	}
+};
 
-	Group* groups = new Group[k];
-	KDTree* kd_tree_nodes = new KDTree[k];
+//Group accumulators of each thread in storage, every array starts on its own cache line so threads never share one
+class ThreadGroups
+{
+public:
+	Group* base;
+	int stride;
+
+	ThreadGroups(int num_threads, int k, std::vector< char >& storage)
+	{
+		stride = (int)(((k * sizeof(Group) + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE / sizeof(Group));
+		storage.resize(num_threads * stride * sizeof(Group) + CACHE_LINE);
+
+		size_t misalignment = (size_t)&storage[0] % CACHE_LINE;
+		base = (Group*)(&storage[0] + (misalignment ? CACHE_LINE - misalignment : 0));
+		for(int i = 0; i < num_threads * stride; ++i)
+			new (base + i) Group();
+	}
+
+	Group* Get(int thread)
+	{
+		return base + thread * stride;
+	}
+};
 
+int KMeansIterate(const Histogram& histogram, ColorRGB* ret, int k, const KMeansOptions& options)
+{
+	KMeansBuffers buffers;
+	return KMeansIterate(histogram, ret, k, options, buffers);
+}
+
+int KMeansIterate(const Histogram& histogram, ColorRGB* ret, int k, const KMeansOptions& options, KMeansBuffers& buffers)
+{
+	Timer timer;
+	const std::vector< HistogramEntry >& entries = histogram.entries;
+	int n = (int)entries.size();
+
+	buffers.groups.resize(k);
+	Group* groups = &buffers.groups[0];
+	KMeansBounds bounded;
+	KMeansBounds* bounds = 0;
+	if(options.bounded)
+	{
+		bounded.Reset(n, k, buffers);
+		bounds = &bounded;
+	}
+
+	//The search structure is rebuilt every iteration, the tuner weighs its build time against n searches. The LUT is left out,
+	//refilling and clearing its 16M entries every iteration never pays off
+	NearestBackend backend = options.nearest;
+	if(!bounds && backend == Nearest_Auto)
+	{
+		std::vector< ColorRGB > sample;
+		for(int i = 0; i < n; i += std::max(1, n / 4096))
+			sample.push_back(entries[i].color);
+		backend = NearestTuner::Global().Choose(ret, k, sample.empty() ? 0 : &sample[0], (int)sample.size(), n, false);
+	}
+	NearestColor& nearest_color = buffers.nearest;
+
+	//The bounds already keep the group of each color
+	if(!bounds)
+		buffers.assignment.assign(n, -1);
+	int* assignment = bounds ? bounds->assignment : buffers.assignment.data();
+
+	ThreadPool* pool = buffers.pool;
+	if(!pool && options.num_threads != 1)
+		pool = new ThreadPool(options.num_threads);
+	int num_threads = pool ? pool->NumThreads() : 1;
+	ThreadGroups thread_groups(num_threads, k, buffers.thread_groups);
+	std::vector< long long > thread_changes(num_threads);
+	std::vector< long long > thread_sse(num_threads);
+
+	long long last_sse = 0;
+	int iterations = 0;
 	while(true)
 	{
+		iterations ++;
 		for(int c = 0; c < k; ++c) 
-		{
 			groups[c].Clear();
-			kd_tree_nodes[c].Reset(&ret[c], &groups[c]);
-		}
 
-		KDTree* kd_tree = KDTree::Build(kd_tree_nodes, kd_tree_nodes + k, 0);
+		if(bounds)
+			bounds->UpdateCentroidDistances(ret, k);
+		else
+			nearest_color.Build(ret, k, backend, num_threads);
 
-		//Group pixels by their closest centroid
-		for(int y = 0; y < img.h; ++ y)
+		//Group colors by their closest centroid, each thread takes a contiguous range of the histogram
+		std::function< void(int) > assign = [&](int t)
 		{
-			for(int x = 0; x < img.w; ++ x)
-			{
-				int idx = (img.w * y + x) * img.depth;
-				ColorRGB color(img.data[idx], img.data[idx + 1], img.data[idx + 2]);
+			Group* local_groups = thread_groups.Get(t);
+			for(int c = 0; c < k; ++c)
+				local_groups[c].Clear();
 
-				//Locate the closest centroid
-				//int best_k = FindClosest(color, ret, k);
-				//groups[best_k].Add(color);
+			long long changes = 0;
+			long long sse = 0;
+			int begin = (int)((long long)n * t / num_threads);
+			int end = (int)((long long)n * (t + 1) / num_threads);
+			for(int i = begin; i < end; ++i)
+			{
+				const HistogramEntry& entry = entries[i];
+				int last = assignment[i];
+				int nearest;
+				if(bounds)
+				{
+					nearest = bounds->Assign(i, entry.color, ret, k);
+				}
+				else
+				{
+					nearest = nearest_color.FindClosest(entry.color);
+					assignment[i] = nearest;
+				}
 
-				KDTree* nearest = kd_tree->Nearest(color);
-				//if(color.Dist(*nearest->color) != color.Dist(ret[best_k]))
-				//	printf("ERROR!!");
-				nearest->group->Add(color);
+				changes += nearest != last;
+				sse += (long long)entry.color.Dist(ret[nearest]) * entry.count;
+				local_groups[nearest].Add(entry.color, entry.count);
 			}
+			thread_changes[t] = changes;
+			thread_sse[t] = sse;
+		};
+
+		if(pool)
+			pool->Run(num_threads, assign);
+		else
+			assign(0);
+
+		//Reduce in thread order
+		long long changes = 0;
+		long long sse = 0;
+		for(int t = 0; t < num_threads; ++t)
+		{
+			Group* local_groups = thread_groups.Get(t);
+			for(int c = 0; c < k; ++c)
+				groups[c].Add(local_groups[c]);
+			changes += thread_changes[t];
+			sse += thread_sse[t];
+		}
+
+		//The centroids are already the means of these groups. The bounds start with every color in group 0 so the first iteration always goes on
+		if(changes == 0 && iterations > 1)
+			break;
+
+		//Rounding the centroids can make colors swap between two groups forever, the error stops going down when that happens.
+		//The centroids of the last iteration are kept when these ones are worse
+		if(iterations > 1 && sse >= last_sse)
+		{
+			if(sse > last_sse)
+				std::copy(buffers.last_centroids.begin(), buffers.last_centroids.end(), ret);
+			break;
 		}
+		buffers.last_centroids.assign(ret, ret + k);
 
 		int dist = 0;
 		//Recalculate centroids
@@ -44,28 +273,149 @@ ColorRGB* KMeans(const Image& img, int k)
 		{
 			Group& group = groups[c];
 
+			if(bounds)
+				bounds->drift[c] = 0.0f;
+
 			if(group.n == 0)
 				continue; //No colors near this one, skip
 
-			group.color[0] /= group.n;
-			group.color[1] /= group.n;
-			group.color[2] /= group.n;
-
-			ColorRGB new_color((unsigned char)group.color[0], (unsigned char)group.color[1], (unsigned char)group.color[2]);
+			ColorRGB new_color = group.Mean();
 			int d = ret[c].Dist(new_color);
 			if(d > dist)
 				dist = d;
 
+			if(bounds)
+				bounds->drift[c] = sqrtf((float)d);
+
 			ret[c] = new_color;
 		}
 
-		//printf("%d\n", dist);
+		//printf("%d %lld %lld\n", dist, changes, sse);
 		if(dist == 0)
 			break;
+		if(options.max_iterations > 0 && iterations >= options.max_iterations)
+			break;
+		if(options.tolerance > 0.0 && iterations > 1 && (double)(last_sse - sse) <= options.tolerance * (double)last_sse)
+			break;
+		if(options.deadline_ms > 0.0 && timer.Elapsed() >= options.deadline_ms)
+			break;
+		last_sse = sse;
+
+		if(bounds)
+			bounds->UpdateBounds(n, k);
 	}
 
-	delete[] kd_tree_nodes;
-	delete[] groups;
+	if(pool != buffers.pool)
+		delete pool;
+
+	return iterations;
+}
+
+int MiniBatchKMeansIterate(const Histogram& histogram, ColorRGB* ret, int k, const KMeansOptions& options)
+{
+	KMeansBuffers buffers;
+	return MiniBatchKMeansIterate(histogram, ret, k, options, buffers);
+}
+
+int MiniBatchKMeansIterate(const Histogram& histogram, ColorRGB* ret, int k, const KMeansOptions& options, KMeansBuffers& buffers)
+{
+	Timer timer;
+	const std::vector< HistogramEntry >& entries = histogram.entries;
+	int n = (int)entries.size();
+	if(n == 0 || k == 0)
+		return 0;
+
+	//A batch wouldn't be smaller than the whole histogram, full iterations are cheaper and exact
+	if(n <= options.batch_size)
+		return KMeansIterate(histogram, ret, k, options, buffers);
+
+	//Drawing a position in the pixel count prefix sums samples pixels without touching the image
+	std::vector< long long > cumulative(n);
+	long long total = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		total += entries[i].count;
+		cumulative[i] = total;
+	}
+
+	//Centroids are kept in float, moves smaller than a level would be lost in ColorRGB
+	std::vector< float > centers(k * 3);
+	std::vector< long long > seen(k, 0);
+	for(int c = 0; c < k; ++c)
+	{
+		for(int i = 0; i < 3; ++i)
+			centers[c * 3 + i] = ret[c][i];
+	}
 
+	buffers.groups.resize(k);
+	buffers.kd_tree_nodes.resize(k);
+	Group* groups = &buffers.groups[0];
+	KDTree* kd_tree_nodes = &buffers.kd_tree_nodes[0];
+	unsigned long long random = 0x9E3779B97F4A7C15ull;
+
+	int batches = 0;
+	while(batches < options.num_batches)
+	{
+		batches ++;
+		for(int c = 0; c < k; ++c)
+		{
+			groups[c].Clear();
+			kd_tree_nodes[c].Reset(&ret[c], &groups[c]);
+		}
+		KDTree* kd_tree = KDTree::Build(kd_tree_nodes, kd_tree_nodes + k, 0);
+
+		for(int s = 0; s < options.batch_size; ++s)
+		{
+			//xorshift64*
+			random ^= random >> 12;
+			random ^= random << 25;
+			random ^= random >> 27;
+			long long pixel = (long long)((random * 0x2545F4914F6CDD1Dull >> 11) % (unsigned long long)total);
+
+			const ColorRGB& color = entries[std::upper_bound(cumulative.begin(), cumulative.end(), pixel) - cumulative.begin()].color;
+			kd_tree->Nearest(color)->group->Add(color);
+		}
+
+		for(int c = 0; c < k; ++c)
+		{
+			const Group& group = groups[c];
+			if(group.n == 0)
+				continue;
+
+			seen[c] += group.n;
+			float rate = (float)group.n / seen[c];
+			for(int i = 0; i < 3; ++i)
+			{
+				float& center = centers[c * 3 + i];
+				center += rate * ((float)group.color[i] / group.n - center);
+			}
+			ret[c] = ColorRGB((unsigned char)(centers[c * 3] + 0.5f), (unsigned char)(centers[c * 3 + 1] + 0.5f), (unsigned char)(centers[c * 3 + 2] + 0.5f));
+		}
+
+		if(options.deadline_ms > 0.0 && timer.Elapsed() >= options.deadline_ms)
+			break;
+	}
+
+	if(options.polish)
+	{
+		KMeansOptions polish_options(options);
+		polish_options.max_iterations = 1;
+		polish_options.deadline_ms = 0.0;
+		batches += KMeansIterate(histogram, ret, k, polish_options, buffers);
+	}
+
+	return batches;
+}
+
+ColorRGB* KMeans(const Histogram& histogram, int k, const KMeansOptions& options)
+{
+	//Initialize palette using octree method
+	ColorRGB* ret = OctreePalette(histogram, k);
+	KMeansIterate(histogram, ret, k, options);
 	return ret;
-}
\ No newline at end of file
+}
+
+ColorRGB* KMeans(const Image& img, int k, const KMeansOptions& options)
+{
+	return KMeans(Histogram(img), k, options);
+}
@@ -2,7 +2,11 @@
 #define KMEANS_H
 
 #include "Image.h"
+#include "Histogram.h"
+#include "NearestColor.h"
+#include <vector>
 #include <algorithm>
+#include <climits>
 
 class KDTree
 {
@@ -97,6 +101,67 @@ private:
 	}
 };
 
-ColorRGB* KMeans(const Image& img, int k);
+class KMeansOptions
+{
+public:
+	//Keep Hamerly distance bounds per color to skip the nearest centroid search of the colors that can't change group
+	bool bounded;
+
+	//Threads used for the assignment step (0 uses all the cores)
+	int num_threads;
+
+	//Nearest centroid search of the unbounded mode, chosen by the tuner by default
+	NearestBackend nearest;
+
+	//Stop conditions, besides stopping when no color changes of group. 0 disables each of them
+	int max_iterations;
+	double tolerance;   //Stop when the SSE improves less than this fraction of the previous one
+	double deadline_ms; //Stop at the end of the first iteration that finishes after this time
+
+	//Mini-batch mode: colors sampled per batch (weighted by their pixel count), number of batches and whether a full Lloyd iteration finishes it
+	int batch_size;
+	int num_batches;
+	bool polish;
+
+	KMeansOptions() : bounded(false), num_threads(1), nearest(Nearest_Auto), max_iterations(0), tolerance(0.0), deadline_ms(0.0), batch_size(4096), num_batches(100), polish(true) {}
+};
+
+class ThreadPool;
+
+//Working memory of the iterations, kept by callers that refine one palette after another so it is only allocated for the largest one
+class KMeansBuffers
+{
+public:
+	std::vector< Group > groups;
+	std::vector< int > assignment; //Group of each histogram color in the last iteration
+	std::vector< KDTree > kd_tree_nodes;
+	NearestColor nearest;
+
+	//Distance bounds of the bounded mode
+	std::vector< float > upper;
+	std::vector< float > lower;
+	std::vector< float > half_min_dist;
+	std::vector< float > drift;
+
+	std::vector< char > thread_groups; //Group accumulators of each thread
+	std::vector< ColorRGB > last_centroids; //Centroids before the last update, restored if they had less error
+
+	//Threads of the assignment step, not owned. When set it is used instead of starting options.num_threads threads in every call
+	ThreadPool* pool;
+
+	KMeansBuffers() : pool(0) {}
+};
+
+//Lloyd iterations refining the k centroids, returns the number of iterations done
+int KMeansIterate(const Histogram& histogram, ColorRGB* centroids, int k, const KMeansOptions& options = KMeansOptions());
+int KMeansIterate(const Histogram& histogram, ColorRGB* centroids, int k, const KMeansOptions& options, KMeansBuffers& buffers);
+
+//Mini-batch kmeans (Sculley 2010), each centroid moves towards the mean of its colors in the batch with a rate of 1 / colors it has seen so far.
+//Costs batch_size searches per batch instead of one per unique color, returns the number of batches done (plus 1 if polished)
+int MiniBatchKMeansIterate(const Histogram& histogram, ColorRGB* centroids, int k, const KMeansOptions& options = KMeansOptions());
+int MiniBatchKMeansIterate(const Histogram& histogram, ColorRGB* centroids, int k, const KMeansOptions& options, KMeansBuffers& buffers);
+
+ColorRGB* KMeans(const Histogram& histogram, int k, const KMeansOptions& options = KMeansOptions());
+ColorRGB* KMeans(const Image& img, int k, const KMeansOptions& options = KMeansOptions());
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "MappedFile.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data(0), size(0), file(INVALID_HANDLE_VALUE), mapping(0)
+{
+}
+#else
+MappedFile::MappedFile() : data(0), size(0), fd(-1)
+{
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* path, bool copy_on_write)
+{
+	Close();
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+
+	mapping = CreateFileMappingA(file, 0, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+	if(!mapping)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const unsigned char*)MapViewOfFile(mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+#else
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)st.st_size;
+
+	void* address = copy_on_write ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	data = address == MAP_FAILED ? 0 : (const unsigned char*)address;
+#endif
+
+	if(!data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::Create(const char* path, size_t size)
+{
+	Close();
+	if(size == 0)
+		return false;
+	this->size = size;
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	//The mapping extends the file to its size
+	unsigned long long size64 = size;
+	mapping = CreateFileMappingA(file, 0, PAGE_READWRITE, (DWORD)(size64 >> 32), (DWORD)size64, 0);
+	if(!mapping)
+	{
+		Close();
+		return false;
+	}
+
+	data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+#else
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, (off_t)size) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* address = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	data = address == MAP_FAILED ? 0 : (const unsigned char*)address;
+#endif
+
+	if(!data)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if(data)
+		UnmapViewOfFile(data);
+	if(mapping)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = 0;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if(data)
+		munmap((void*)data, size);
+	if(fd >= 0)
+		close(fd);
+	fd = -1;
+#endif
+	data = 0;
+	size = 0;
+}
+
+void MappedFile::Swap(MappedFile& other)
+{
+	std::swap(data, other.data);
+	std::swap(size, other.size);
+#ifdef _WIN32
+	std::swap(file, other.file);
+	std::swap(mapping, other.mapping);
+#else
+	std::swap(fd, other.fd);
+#endif
+}
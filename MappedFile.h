@@ -0,0 +1,42 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+
+//Whole file mapped in memory. Read-only pages are shared between the processes mapping the same file
+class MappedFile
+{
+public:
+	const unsigned char* data;
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+
+	//With copy_on_write the pages can be written through Writable(), the first write of a page copies it and the file isn't modified
+	bool Open(const char* path, bool copy_on_write = false);
+	//New file of size bytes mapped for writing, what is written through Writable() goes to the file
+	bool Create(const char* path, size_t size);
+	void Close();
+
+	//Only after opening with copy_on_write or Create
+	unsigned char* Writable() const
+	{
+		return (unsigned char*)data;
+	}
+
+	void Swap(MappedFile& other);
+
+private:
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+#endif
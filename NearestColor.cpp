@@ -0,0 +1,292 @@
+#include "NearestColor.h"
+#include "Stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+//Bump when a backend changes enough to make cached timings useless
+#define NEAREST_TUNE_VERSION 3
+//Colors whose LUT entries are filled to estimate the time of a full fill
+#define NEAREST_TUNE_LUT_COLORS 65536
+
+static const char* backend_names[NEAREST_NUM_BACKENDS + 1] = { "scalar", "simd", "kdtree", "grid", "lut", "auto" };
+
+const char* NearestBackendName(NearestBackend backend)
+{
+	return backend_names[backend];
+}
+
+NearestBackend NearestBackendFromName(const char* name)
+{
+	for(int b = 0; b < NEAREST_NUM_BACKENDS; ++b)
+	{
+		if(!strcmp(name, backend_names[b]))
+			return (NearestBackend)b;
+	}
+	return Nearest_Auto;
+}
+
+void NearestColor::Build(ColorRGB* palette, int k, NearestBackend backend, int num_threads)
+{
+	this->backend = backend;
+	switch(backend)
+	{
+		case Nearest_Scalar: scalar.Reset(palette, k); break;
+		case Nearest_KDTree: kd_tree.Build(palette, k); break;
+		case Nearest_Grid:   grid.Build(palette, k); break;
+		case Nearest_LUT:    lut.Build(palette, k, num_threads == 1, num_threads); break;
+		default:             this->backend = Nearest_SIMD; simd.Reset(palette, k); break;
+	}
+}
+
+NearestTuner::NearestTuner() : loaded(false)
+{
+	const char* env = getenv("ZIMGQUANT_TUNE_CACHE");
+	if(env)
+	{
+		cache_path = env;
+	}
+	else
+	{
+#ifdef _WIN32
+		const char* dir = getenv("LOCALAPPDATA");
+		if(dir)
+			cache_path = std::string(dir) + "\\ZIMGQuant.tune";
+#else
+		const char* dir = getenv("HOME");
+		if(dir)
+			cache_path = std::string(dir) + "/.zimgquant_tune";
+#endif
+	}
+
+	const char* simd_names[3] = { "none", "sse4.1", "avx2" };
+	cpu = CPUName() + " " + simd_names[DetectSIMD()];
+}
+
+//Time spent measuring backends by each thread, see ThreadTuneMs
+static thread_local double thread_tune_ms = 0.0;
+
+//The timed searches add their results here so the compiler can't remove them
+static volatile long long tune_sink = 0;
+
+NearestTuner& NearestTuner::Global()
+{
+	static NearestTuner tuner;
+	return tuner;
+}
+
+//Lines are: version, cpu, k and the build ms and ns per query of each backend, separated by tabs
+void NearestTuner::Load()
+{
+	loaded = true;
+	if(cache_path.empty())
+		return;
+
+	FILE* file = fopen(cache_path.c_str(), "r");
+	if(!file)
+		return;
+
+	char line[1024];
+	while(fgets(line, sizeof(line), file))
+	{
+		char* fields[3 + NEAREST_NUM_BACKENDS];
+		int num_fields = 0;
+		for(char* it = strtok(line, "\t\r\n"); it && num_fields < 3 + NEAREST_NUM_BACKENDS; it = strtok(0, "\t\r\n"))
+			fields[num_fields ++] = it;
+
+		if(num_fields != 3 + NEAREST_NUM_BACKENDS || atoi(fields[0]) != NEAREST_TUNE_VERSION || cpu != fields[1])
+			continue;
+
+		std::vector< NearestTiming > k_timings(NEAREST_NUM_BACKENDS);
+		for(int b = 0; b < NEAREST_NUM_BACKENDS; ++b)
+		{
+			if(sscanf(fields[3 + b], "%lf %lf", &k_timings[b].build_ms, &k_timings[b].ns_per_query) != 2)
+				k_timings.clear();
+			if(k_timings.empty())
+				break;
+		}
+		if(!k_timings.empty())
+			timings[atoi(fields[2])] = k_timings;
+	}
+	fclose(file);
+}
+
+//Rewrites the file with the line of k, dropping the older lines of the same version, cpu and k and the lines of older versions.
+//Every writer fills its own temporary file and renames it, so processes tuning at once never leave a partial file
+void NearestTuner::Save(int k, const std::vector< NearestTiming >& k_timings)
+{
+	if(cache_path.empty())
+		return;
+
+	std::vector< std::string > lines;
+	FILE* file = fopen(cache_path.c_str(), "r");
+	if(file)
+	{
+		char line[1024];
+		while(fgets(line, sizeof(line), file))
+		{
+			std::string entry(line);
+			size_t cpu_start = entry.find('\t');
+			size_t cpu_end = cpu_start == std::string::npos ? std::string::npos : entry.find('\t', cpu_start + 1);
+			if(cpu_end == std::string::npos || atoi(line) < NEAREST_TUNE_VERSION)
+				continue;
+			if(atoi(line) == NEAREST_TUNE_VERSION && entry.compare(cpu_start + 1, cpu_end - cpu_start - 1, cpu) == 0 && atoi(line + cpu_end + 1) == k)
+				continue;
+
+			if(entry[entry.size() - 1] != '\n')
+				entry += '\n';
+			lines.push_back(entry);
+		}
+		fclose(file);
+	}
+
+	static std::atomic< unsigned int > num_saves(0);
+	char suffix[64];
+	sprintf(suffix, ".%d.%u.tmp", (int)getpid(), num_saves++);
+	std::string tmp_path = cache_path + suffix;
+	FILE* out = fopen(tmp_path.c_str(), "w");
+	if(!out)
+		return;
+
+	for(size_t i = 0; i < lines.size(); ++i)
+		fputs(lines[i].c_str(), out);
+	fprintf(out, "%d\t%s\t%d", NEAREST_TUNE_VERSION, cpu.c_str(), k);
+	for(int b = 0; b < NEAREST_NUM_BACKENDS; ++b)
+		fprintf(out, "\t%.4f %.3f", k_timings[b].build_ms, k_timings[b].ns_per_query);
+	fprintf(out, "\n");
+	bool ok = fclose(out) == 0;
+
+	//rename doesn't replace existing files on Windows
+	if(ok && rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+	{
+		remove(cache_path.c_str());
+		ok = rename(tmp_path.c_str(), cache_path.c_str()) == 0;
+	}
+	if(!ok)
+		remove(tmp_path.c_str());
+}
+
+//Best of 3 times of the samples looked up in a table of every 24 bit color like the LUT backend does.
+//Only the entries of the samples are filled, the pages of the rest are never touched so the table costs no time to build
+template< class T >
+static double TimeTableLookups(const InverseColormap& grid, const ColorRGB* sample, int num_samples, long long& checksum)
+{
+	T* table = new T[COLORLUT_SIZE];
+	for(int i = 0; i < num_samples; ++i)
+		table[(sample[i].R << 16) | (sample[i].G << 8) | sample[i].B] = (T)grid.FindClosest(sample[i]);
+
+	double min_ms = 1e30;
+	for(int r = 0; r < 3; ++r)
+	{
+		Timer timer;
+		for(int i = 0; i < num_samples; ++i)
+			checksum += table[(sample[i].R << 16) | (sample[i].G << 8) | sample[i].B];
+		min_ms = std::min(min_ms, timer.Elapsed());
+	}
+	delete[] table;
+	return min_ms;
+}
+
+std::vector< NearestTiming > NearestTuner::Timings(ColorRGB* palette, int k, const ColorRGB* sample, int num_samples)
+{
+	std::lock_guard< std::mutex > lock(mutex);
+	if(!loaded)
+		Load();
+
+	std::map< int, std::vector< NearestTiming > >::iterator it = timings.find(k);
+	if(it != timings.end())
+		return it->second;
+
+	//Without a sample the palette itself is searched
+	if(num_samples == 0)
+	{
+		sample = palette;
+		num_samples = k;
+	}
+
+	Timer tune_timer;
+	std::vector< NearestTiming > k_timings(NEAREST_NUM_BACKENDS);
+	long long checksum = 0;
+	InverseColormap grid; //Kept from the grid backend for the LUT estimate
+	for(int b = 0; b < NEAREST_NUM_BACKENDS; ++b)
+	{
+		if(b == Nearest_LUT)
+		{
+			//A full fill costs the grid build plus a grid search per 24 bit color, estimated from a part of them spread over the cube
+			Timer timer;
+			for(int i = 0; i < NEAREST_TUNE_LUT_COLORS; ++i)
+				checksum += grid.FindClosest(ColorRGB((unsigned char)(i >> 8), (unsigned char)i, (unsigned char)(i * 37)));
+			k_timings[b].build_ms = k_timings[Nearest_Grid].build_ms + timer.Elapsed() * (COLORLUT_SIZE / NEAREST_TUNE_LUT_COLORS);
+
+			double ms = k <= 256 ? TimeTableLookups< unsigned char >(grid, sample, num_samples, checksum) : TimeTableLookups< unsigned short >(grid, sample, num_samples, checksum);
+			k_timings[b].ns_per_query = ms * 1e6 / num_samples;
+			continue;
+		}
+
+		NearestColor nearest;
+		Timer timer;
+		nearest.Build(palette, k, (NearestBackend)b);
+		k_timings[b].build_ms = timer.Elapsed();
+
+		//Best of 3 so a context switch doesn't decide. The kd-tree is seeded with the previous result like the mapping does
+		double min_ms = 1e30;
+		for(int r = 0; r < 3; ++r)
+		{
+			timer.Reset();
+			int last = -1;
+			for(int i = 0; i < num_samples; ++i)
+			{
+				last = b == Nearest_KDTree ? nearest.kd_tree.FindClosest(sample[i], last) : nearest.FindClosest(sample[i]);
+				checksum += last;
+			}
+			min_ms = std::min(min_ms, timer.Elapsed());
+		}
+		k_timings[b].ns_per_query = min_ms * 1e6 / num_samples;
+
+		if(b == Nearest_Grid)
+			std::swap(grid, nearest.grid);
+	}
+
+	//Keeps the searches from being optimized away
+	tune_sink = checksum;
+
+	timings[k] = k_timings;
+	Save(k, k_timings);
+	thread_tune_ms += tune_timer.Elapsed();
+	return k_timings;
+}
+
+double NearestTuner::ThreadTuneMs()
+{
+	return thread_tune_ms;
+}
+
+NearestBackend NearestTuner::Choose(ColorRGB* palette, int k, const ColorRGB* sample, int num_samples, long long num_queries, bool allow_lut)
+{
+	std::vector< NearestTiming > k_timings = Timings(palette, k, sample, num_samples);
+
+	int best = Nearest_SIMD;
+	double best_cost = 0.0;
+	for(int b = 0; b < NEAREST_NUM_BACKENDS; ++b)
+	{
+		if(b == Nearest_LUT && !allow_lut)
+			continue;
+
+		double cost = k_timings[b].build_ms * 1e6 + k_timings[b].ns_per_query * num_queries;
+		if(b == 0 || cost < best_cost)
+		{
+			best = b;
+			best_cost = cost;
+		}
+	}
+	return (NearestBackend)best;
+}
@@ -0,0 +1,112 @@
+#ifndef NEARESTCOLOR_H
+#define NEARESTCOLOR_H
+
+#include "Image.h"
+#include "SIMDPalette.h"
+#include "FlatKDTree.h"
+#include "InverseColormap.h"
+#include "ColorLUT.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+
+//Backends before Nearest_Auto (declared in Image.h)
+#define NEAREST_NUM_BACKENDS 5
+
+const char* NearestBackendName(NearestBackend backend);
+//Nearest_Auto for unknown names
+NearestBackend NearestBackendFromName(const char* name);
+
+//Plain brute force search, the reference for the others
+class ScalarPalette
+{
+public:
+	ColorRGB* palette;
+	int k;
+
+	void Reset(ColorRGB* palette, int k)
+	{
+		this->palette = palette;
+		this->k = k;
+	}
+
+	int FindClosest(const ColorRGB& color) const
+	{
+		return ::FindClosest(color, palette, k);
+	}
+};
+
+//Every backend behind one interface. Hot loops should take the member of the selected backend directly (see Image::SetPalette),
+//FindClosest here costs one extra predictable branch per search
+class NearestColor
+{
+public:
+	NearestBackend backend;
+	ScalarPalette scalar;
+	SIMDPalette simd;
+	FlatKDTree kd_tree;
+	InverseColormap grid;
+	ColorLUT lut;
+
+	NearestColor() : backend(Nearest_SIMD) {}
+
+	//The palette must outlive the scalar backend. backend can't be Nearest_Auto.
+	//The LUT is filled lazily for one thread and eagerly with num_threads threads otherwise
+	void Build(ColorRGB* palette, int k, NearestBackend backend, int num_threads = 1);
+
+	int FindClosest(const ColorRGB& color) const
+	{
+		switch(backend)
+		{
+			case Nearest_Scalar: return scalar.FindClosest(color);
+			case Nearest_KDTree: return kd_tree.FindClosest(color);
+			case Nearest_Grid:   return grid.FindClosest(color);
+			case Nearest_LUT:    return lut.FindClosest(color);
+			default:             return simd.FindClosest(color);
+		}
+	}
+};
+
+//Cost of a backend for one palette size on this cpu
+class NearestTiming
+{
+public:
+	double build_ms;
+	double ns_per_query;
+};
+
+//Times every backend on a sample of the colors that will be searched and picks the one with the lowest build + queries time.
+//Timings are cached per (cpu, palette size) in memory and in a text file so later runs skip the measurements
+class NearestTuner
+{
+public:
+	//Empty disables the file
+	std::string cache_path;
+
+	NearestTuner();
+
+	//Shared by the whole process, its cache file is ZIMGQUANT_TUNE_CACHE or a file in the user's home
+	static NearestTuner& Global();
+
+	//sample are colors like the ones that will be searched, num_queries is the number of searches done per build
+	//allow_lut false leaves the LUT out, for callers that build the structure again for every few searches
+	NearestBackend Choose(ColorRGB* palette, int k, const ColorRGB* sample, int num_samples, long long num_queries, bool allow_lut = true);
+
+	//Measured or cached timings of palettes of k colors (one per backend), measured with palette and sample if needed
+	std::vector< NearestTiming > Timings(ColorRGB* palette, int k, const ColorRGB* sample, int num_samples);
+
+	//Milliseconds the calling thread has spent measuring backends since it started, so callers can tell tuning apart from their own work
+	static double ThreadTuneMs();
+
+private:
+	std::mutex mutex;
+	bool loaded;
+	std::string cpu;
+	std::map< int, std::vector< NearestTiming > > timings;
+
+	void Load();
+	void Save(int k, const std::vector< NearestTiming >& k_timings);
+};
+
+#endif
@@ -1,93 +1,216 @@
 #include "Octree.h"
 
-Octree::Octree() : num_leaves(0)
+class NodeCountCmp
 {
-	root = new OctreeNode(this, 0);
+public:
+	const std::vector< OctreeNode >& nodes;
+	NodeCountCmp(const std::vector< OctreeNode >& nodes) : nodes(nodes) {}
+
+	bool operator()(unsigned int n0, unsigned int n1) const
+	{
+		return nodes[n0].n > nodes[n1].n;
+	}
+};
+
+Octree::Octree(int max_leaves) : max_leaves(max_leaves)
+{
+	nodes.reserve(4096);
+	Clear();
 }
 
-Octree::~Octree()
+void Octree::Clear()
 {
-	delete root;
+	nodes.clear();
+	nodes.resize(1);
+	nodes[0].Clear();
+
+	for(int i = 0; i < 9; ++i)
+		num_nodes_by_level[i] = 0;
+	num_nodes_by_level[0] = 1;
+	num_leaves = 0;
+
+	for(int i = 0; i < 8; ++i)
+	{
+		num_reduced_by_level[i] = 0;
+		reducible[i].clear();
+	}
+	free_nodes.clear();
+}
+
+void Octree::Reduce()
+{
+	//Merge the node with less pixels among the ones with several children on the deepest level. Below it there are only
+	//chains of single children ending in a leaf, so it loses one leaf per child
+	int level = 7;
+	while(level >= 0 && reducible[level].empty())
+		level --;
+	if(level < 0)
+		return;
+
+	std::vector< unsigned int >& candidates = reducible[level];
+	size_t best = 0;
+	for(size_t i = 1; i < candidates.size(); ++i)
+	{
+		if(nodes[candidates[i]].n < nodes[candidates[best]].n)
+			best = i;
+	}
+	unsigned int node = candidates[best];
+	candidates[best] = candidates.back();
+	candidates.pop_back();
+
+	int removed = 0;
+	for(int i = 0; i < 8; ++i)
+	{
+		unsigned int child = nodes[node].nodes[i];
+		if(child == 0)
+			continue;
+
+		//Color sums of the children are already in the parent
+		FreeNode(child, level + 1);
+		nodes[node].nodes[i] = 0;
+		removed ++;
+	}
+
+	num_reduced_by_level[level] ++;
+	num_leaves -= removed - 1;
+}
+
+//Releases node and its descendants
+void Octree::FreeNode(unsigned int node, int level)
+{
+	if(level < 8)
+	{
+		for(int i = 0; i < 8; ++i)
+		{
+			if(nodes[node].nodes[i])
+				FreeNode(nodes[node].nodes[i], level + 1);
+		}
+		if(!nodes[node].HasChildren())
+			num_reduced_by_level[level] --;
+	}
+	num_nodes_by_level[level] --;
+	free_nodes.push_back(node);
+}
+
+void Octree::CollectLevel(unsigned int node, int level, int target_level, std::vector< unsigned int >& out) const
+{
+	if(level == target_level || !nodes[node].HasChildren())
+	{
+		out.push_back(node);
+		return;
+	}
+
+	for(int i = 0; i < 8; ++i)
+	{
+		if(nodes[node].nodes[i])
+			CollectLevel(nodes[node].nodes[i], level + 1, target_level, out);
+	}
 }
 
 ColorRGB* Octree::GetPalette(size_t num_colors)
 {
-	//Locate the level where we should start reducing nodes
+	//Locate the level where we should start reducing nodes (leaves reduced on previous levels count on all the next ones)
 	int current_level = 0;
-	while(current_level < 8 && nodes_by_level[current_level + 1].size() < num_colors)
+	int reduced = num_reduced_by_level[0];
+	while(current_level < 8 && (size_t)(num_nodes_by_level[current_level + 1] + reduced) < num_colors)
 	{
 		current_level ++;
+		if(current_level < 8)
+			reduced += num_reduced_by_level[current_level];
 	}
 
-	//Sort this level
-	std::sort(nodes_by_level[current_level].begin(), nodes_by_level[current_level].end(), OctreeNode::comp);
+	//Sort this level (in creation order before sorting, that is, arena order)
+	std::vector< unsigned int > level_nodes;
+	CollectLevel(0, 0, current_level, level_nodes);
+	std::sort(level_nodes.begin(), level_nodes.end());
+	std::sort(level_nodes.begin(), level_nodes.end(), NodeCountCmp(nodes));
 
 	ColorRGB* ret = new ColorRGB[num_colors];
 	int ret_size = 0;
 
-	std::vector< OctreeNode* >& nodes = nodes_by_level[current_level];
-	std::vector< OctreeNode* > children(8);
-	for(size_t i = 0; i < nodes.size(); ++i)
+	std::vector< unsigned int > children(8);
+	for(size_t i = 0; i < level_nodes.size(); ++i)
 	{
-		OctreeNode* node = nodes[i];
-		size_t max_children = num_colors - (nodes.size() - i) - ret_size + 1;
-		if(max_children > 1)
+		OctreeNode& node = nodes[level_nodes[i]];
+		size_t max_children = num_colors - (level_nodes.size() - i) - ret_size + 1;
+		if(max_children > 1 && node.HasChildren())
 		{
 			//Pick the maximum amount of children on this node
 			children.clear();
 			for(int j = 0; j < 8; ++j)
 			{
-				if(node->nodes[j])
+				if(node.nodes[j])
 				{
-					children.push_back(node->nodes[j]);
+					children.push_back(node.nodes[j]);
 				}
 			}
 
 			if(children.size() > max_children)
 			{
 				//Add the nodes with less colors into the last position
-				std::sort(children.begin(), children.end(), OctreeNode::comp);
+				std::sort(children.begin(), children.end(), NodeCountCmp(nodes));
 
-				Group& group = (*(children.begin() + max_children - 1))->group;
-				for(std::vector< OctreeNode* >::iterator it = children.begin() + max_children; it != children.end(); ++ it)
+				OctreeNode& last = nodes[*(children.begin() + max_children - 1)];
+				for(std::vector< unsigned int >::iterator it = children.begin() + max_children; it != children.end(); ++ it)
 				{
-					group.color[0] += (*it)->group.color[0];
-					group.color[1] += (*it)->group.color[1];
-					group.color[2] += (*it)->group.color[2];
-					group.n += (*it)->group.n;
+					last.Add(nodes[*it]);
 				}
 
 				//Remove the colors added together
 				children.erase(children.begin() + max_children, children.end());
 			}
 
-			for(std::vector< OctreeNode* >::iterator it = children.begin(); it != children.end(); ++ it)
+			for(std::vector< unsigned int >::iterator it = children.begin(); it != children.end(); ++ it)
 			{
-				Group& group = (*it)->group;
-				ret[ret_size ++] = ColorRGB((unsigned char)(group.color[0] / group.n), (unsigned char)(group.color[1] / group.n), (unsigned char)(group.color[2] / group.n));
+				ret[ret_size ++] = nodes[*it].Mean();
 			}
 		}
 		else
 		{
 			//Reduce this node (ignore children)
-			Group& group = nodes[i]->group;
-			ret[ret_size ++] = ColorRGB((unsigned char)(group.color[0] / group.n), (unsigned char)(group.color[1] / group.n), (unsigned char)(group.color[2] / group.n));
+			ret[ret_size ++] = node.Mean();
 		}
 	}
 
+	//Less colors than requested, repeat the last one
+	for(; (size_t)ret_size < num_colors; ++ret_size)
+		ret[ret_size] = ret_size ? ret[ret_size - 1] : ColorRGB(0, 0, 0);
+
 	return ret;
 }
 
-ColorRGB* OctreePalette(const Image& image, int num_colors)
+void Octree::AddHistogram(const Histogram& histogram)
+{
+	for(size_t i = 0; i < histogram.entries.size(); ++i)
+	{
+		Add(histogram.entries[i].color, histogram.entries[i].count);
+	}
+}
+
+void Octree::AddImage(const Image& image)
 {
-	Octree octree;
 	for(int y = 0; y < image.h; ++ y)
 	{
-		for(int x = 0; x < image.h; ++ x)
+		for(int x = 0; x < image.w; ++ x)
 		{
-			octree.root->Add(image.Get(x, y), &octree);
+			Add(image.Get(x, y), 1);
 		}
 	}
+}
+
+ColorRGB* OctreePalette(const Histogram& histogram, int num_colors, int max_leaves)
+{
+	Octree octree(max_leaves ? std::max(max_leaves, num_colors) : 0);
+	octree.AddHistogram(histogram);
+	return octree.GetPalette(num_colors);
+}
 
+ColorRGB* OctreePalette(const Image& image, int num_colors, int max_leaves)
+{
+	if(max_leaves == 0)
+		return OctreePalette(Histogram(image), num_colors);
+
+	Octree octree(std::max(max_leaves, num_colors));
+	octree.AddImage(image);
 	return octree.GetPalette(num_colors);
-}
\ No newline at end of file
+}
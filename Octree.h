@@ -2,67 +2,148 @@
 #define OCTREE_H
 
 #include "Image.h"
+#include "Histogram.h"
 #include <vector>
 #include <algorithm>
 
 #define BIT(V, N) (((V) >> (N)) & 0x1)
-class OctreeNode;
-class Octree
-{
-public:
-	OctreeNode* root;
-	std::vector< OctreeNode* > nodes_by_level[8];
-	int num_leaves;
-	
-	Octree();
-	~Octree();
-	ColorRGB* GetPalette(size_t num_colors);
-};
 
+//Children are indices in the octree arena, 0 (the root) means no child
+//A node above the last level without children is a leaf created by a reduction
 class OctreeNode
 {
 public:
-	Group group;
-	OctreeNode* nodes[8];
+	unsigned long long color[3];
+	unsigned long long n;
+	unsigned int nodes[8];
 
-	OctreeNode(Octree* tree, int level)
+	void Clear()
 	{
+		color[0] = color[1] = color[2] = 0;
+		n = 0;
 		for(int i = 0; i < 8; ++i)
 			nodes[i] = 0;
+	}
+
+	void Add(const ColorRGB& color, long long count)
+	{
+		this->color[0] += (unsigned long long)color.R * count;
+		this->color[1] += (unsigned long long)color.G * count;
+		this->color[2] += (unsigned long long)color.B * count;
+		n += count;
+	}
 
-		if(level >= 0 && level < 8)
-			tree->nodes_by_level[level].push_back(this);
+	void Add(const OctreeNode& other)
+	{
+		color[0] += other.color[0];
+		color[1] += other.color[1];
+		color[2] += other.color[2];
+		n += other.n;
+	}
+
+	ColorRGB Mean() const
+	{
+		return ColorRGB((unsigned char)(color[0] / n), (unsigned char)(color[1] / n), (unsigned char)(color[2] / n));
 	}
 
-	~OctreeNode()
+	bool HasChildren() const
 	{
 		for(int i = 0; i < 8; ++i)
-			if(nodes[i]) delete nodes[i];
+			if(nodes[i]) return true;
+		return false;
 	}
 
-	void Add(const ColorRGB& color, Octree* tree, int level = 0)
+	int NumChildren() const
 	{
-		this->group.Add(color);
+		int ret = 0;
+		for(int i = 0; i < 8; ++i)
+			ret += nodes[i] != 0;
+		return ret;
+	}
+};
+
+//All the nodes are stored contiguously in one arena, released at once
+//With max_leaves set the deepest nodes are merged while adding colors so the tree never has more leaves than that
+class Octree
+{
+public:
+	std::vector< OctreeNode > nodes;
+	int num_nodes_by_level[9];
+	int num_reduced_by_level[8];
+	int num_leaves;
+	int max_leaves;
+	
+	Octree(int max_leaves = 0);
+
+	//Removes all the colors keeping the memory allocated
+	void Clear();
 
-		if(level < 8)
+	void Add(const ColorRGB& color, long long count)
+	{
+		unsigned int node = 0;
+		for(int level = 0; ; ++level)
 		{
+			bool reduced = max_leaves && level < 8 && nodes[node].n > 0 && !nodes[node].HasChildren();
+			nodes[node].Add(color, count);
+			if(level == 8 || reduced)
+				break;
+
 			int idx = (BIT(color.R, 7 - level) << 2) | (BIT(color.G, 7 - level) << 1) | BIT(color.B, 7 - level);
-			if(nodes[idx] == 0)
+			unsigned int child = nodes[node].nodes[idx];
+			if(child == 0)
 			{
-				nodes[idx] = new OctreeNode(tree, level + 1);
-				if(level == 7)
-					tree->num_leaves ++;
+				child = NewNode(level + 1);
+				nodes[node].nodes[idx] = child;
+
+				//Merging a node with one child wouldn't remove any leaf
+				if(max_leaves && nodes[node].NumChildren() == 2)
+					reducible[level].push_back(node);
 			}
-			nodes[idx]->Add(color, tree, level + 1);
+			node = child;
 		}
+
+		while(max_leaves && num_leaves > max_leaves)
+			Reduce();
 	}
 
-	static bool comp(OctreeNode* n0, OctreeNode* n1)
+	void AddHistogram(const Histogram& histogram);
+	void AddImage(const Image& image);
+
+	ColorRGB* GetPalette(size_t num_colors);
+
+private:
+	std::vector< unsigned int > reducible[8]; //Nodes with at least 2 children on each level
+	std::vector< unsigned int > free_nodes;
+
+	unsigned int NewNode(int level)
 	{
-		return n0->group.n > n1->group.n;
+		unsigned int idx;
+		if(free_nodes.empty())
+		{
+			nodes.resize(nodes.size() + 1);
+			idx = (unsigned int)nodes.size() - 1;
+		}
+		else
+		{
+			idx = free_nodes.back();
+			free_nodes.pop_back();
+		}
+		nodes[idx].Clear();
+
+		num_nodes_by_level[level] ++;
+		if(level == 8)
+			num_leaves ++;
+		return idx;
 	}
+
+	void Reduce();
+	void FreeNode(unsigned int node, int level);
+	void CollectLevel(unsigned int node, int level, int target_level, std::vector< unsigned int >& out) const;
 };
 
-ColorRGB* OctreePalette(const Image& image, int num_colors);
+ColorRGB* OctreePalette(const Histogram& histogram, int num_colors, int max_leaves = 0);
+
+//With max_leaves the pixels are added directly so memory doesn't depend on the number of unique colors
+ColorRGB* OctreePalette(const Image& image, int num_colors, int max_leaves = 0);
 
-#endif
\ No newline at end of file
+#endif
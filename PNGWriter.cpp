@@ -0,0 +1,202 @@
+#include "PNGWriter.h"
+#include "IndexedImage.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+//Defined by stb_image_write.c but not declared in its header
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+class CRCTable
+{
+public:
+	unsigned int values[256];
+
+	CRCTable()
+	{
+		for(unsigned int n = 0; n < 256; ++n)
+		{
+			unsigned int c = n;
+			for(int b = 0; b < 8; ++b)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			values[n] = c;
+		}
+	}
+};
+
+//CRC-32 of the PNG chunks, continued from crc
+static unsigned int CRC(const unsigned char* data, size_t size, unsigned int crc = 0)
+{
+	static const CRCTable table;
+	crc = ~crc;
+	for(size_t i = 0; i < size; ++i)
+		crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void PutBE32(unsigned char* out, unsigned int v)
+{
+	out[0] = (unsigned char)(v >> 24);
+	out[1] = (unsigned char)(v >> 16);
+	out[2] = (unsigned char)(v >> 8);
+	out[3] = (unsigned char)v;
+}
+
+static bool WriteChunk(FILE* out, const char* type, const unsigned char* data, unsigned int size)
+{
+	unsigned char header[8];
+	PutBE32(header, size);
+	memcpy(header + 4, type, 4);
+
+	unsigned char crc[4];
+	PutBE32(crc, CRC(data, size, CRC(header + 4, 4)));
+
+	return fwrite(header, 1, 8, out) == 8 && (size == 0 || fwrite(data, 1, size, out) == size) && fwrite(crc, 1, 4, out) == 4;
+}
+
+//Estimated cost of a filtered row, the number of runs of the same byte. The usual sum of absolute differences assumes intensities,
+//indices are labels so only none, sub and up (rows repeated from the previous one become one run of zeros) are tried
+static int RowCost(const unsigned char* row, int size)
+{
+	int cost = 1;
+	for(int i = 1; i < size; ++i)
+		cost += row[i] != row[i - 1];
+	return cost;
+}
+
+int PNGWriter::BitDepth(int k)
+{
+	if(k <= 2)
+		return 1;
+	if(k <= 4)
+		return 2;
+	if(k <= 16)
+		return 4;
+	return 8;
+}
+
+bool PNGWriter::Write(const char* path, const unsigned char* indices, int w, int h, const ColorRGB* palette, int k, const unsigned char* alpha)
+{
+	if(k < 1 || k > 256 || w <= 0 || h <= 0)
+		return false;
+
+	//Pack the indices, most significant bits first. 8 bit rows are the indices themselves
+	int bits = BitDepth(k);
+	int row_bytes = (w * bits + 7) / 8;
+	int per_byte = 8 / bits;
+	packed.assign(bits == 8 ? 0 : (size_t)row_bytes * h, 0);
+	for(int y = 0; y < h && bits != 8; ++y)
+	{
+		const unsigned char* src = indices + (size_t)y * w;
+		unsigned char* dst = &packed[(size_t)y * row_bytes];
+		for(int x = 0; x < w; ++x)
+			dst[x / per_byte] |= src[x] << (8 - bits - (x % per_byte) * bits);
+	}
+	const unsigned char* rows = bits == 8 ? indices : &packed[0];
+
+	//Filter each row, the filter is the first byte of the row
+	filtered.resize((size_t)(row_bytes + 1) * h);
+	candidate.resize(row_bytes);
+	for(int y = 0; y < h; ++y)
+	{
+		const unsigned char* row = rows + (size_t)y * row_bytes;
+		const unsigned char* prev = y > 0 ? row - row_bytes : 0;
+		unsigned char* dst = &filtered[(size_t)y * (row_bytes + 1)];
+
+		int best_filter = 0;
+		if(filter == PNG_FILTER_AUTO)
+		{
+			int best_cost = RowCost(row, row_bytes);
+			for(int f = 1; f <= 2; ++f)
+			{
+				if(f == 2 && !prev)
+					break;
+				for(int i = 0; i < row_bytes; ++i)
+					candidate[i] = row[i] - (f == 1 ? (i > 0 ? row[i - 1] : 0) : prev[i]);
+				int cost = RowCost(&candidate[0], row_bytes);
+				//None unless clearly better, on dithered images the other filters leave fewer runs but worse matches for deflate
+				if(cost * 4 < best_cost * 3)
+				{
+					best_cost = cost;
+					best_filter = f;
+				}
+			}
+		}
+		else if(filter == 1 || (filter == 2 && prev))
+		{
+			best_filter = filter;
+		}
+
+		dst[0] = (unsigned char)best_filter;
+		for(int i = 0; i < row_bytes; ++i)
+		{
+			unsigned char predicted = 0;
+			if(best_filter == 1 && i > 0)
+				predicted = row[i - 1];
+			else if(best_filter == 2)
+				predicted = prev[i];
+			dst[i + 1] = row[i] - predicted;
+		}
+	}
+
+	int compressed_size = 0;
+	unsigned char* compressed = stbi_zlib_compress(&filtered[0], (int)filtered.size(), &compressed_size, level);
+	if(!compressed)
+		return false;
+
+	FILE* out = fopen(path, "wb");
+	if(!out)
+	{
+		free(compressed);
+		return false;
+	}
+
+	static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	unsigned char ihdr[13];
+	PutBE32(ihdr, w);
+	PutBE32(ihdr + 4, h);
+	ihdr[8] = (unsigned char)bits;
+	ihdr[9] = 3; //Indexed color
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+
+	std::vector< unsigned char > plte(k * 3);
+	for(int c = 0; c < k; ++c)
+	{
+		plte[c * 3    ] = palette[c].R;
+		plte[c * 3 + 1] = palette[c].G;
+		plte[c * 3 + 2] = palette[c].B;
+	}
+
+	//Entries after the last transparent one are opaque and can be left out
+	int num_alpha = 0;
+	if(alpha)
+	{
+		for(int c = 0; c < k; ++c)
+		{
+			if(alpha[c] != 255)
+				num_alpha = c + 1;
+		}
+	}
+
+	bool ok = fwrite(signature, 1, 8, out) == 8;
+	ok = ok && WriteChunk(out, "IHDR", ihdr, 13);
+	ok = ok && WriteChunk(out, "PLTE", &plte[0], k * 3);
+	if(num_alpha)
+		ok = ok && WriteChunk(out, "tRNS", alpha, num_alpha);
+	ok = ok && WriteChunk(out, "IDAT", compressed, compressed_size);
+	ok = ok && WriteChunk(out, "IEND", 0, 0);
+	ok = fclose(out) == 0 && ok;
+
+	free(compressed);
+	return ok;
+}
+
+bool PNGWriter::Write(const char* path, const IndexedImage& img)
+{
+	if(img.IndexSize() != 1)
+		return false;
+	return Write(path, img.Indices8(), img.w, img.h, &img.palette[0], (int)img.palette.size());
+}
@@ -0,0 +1,38 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include "Image.h"
+#include <vector>
+
+class IndexedImage;
+
+//Same default as stbi_write_png
+#define PNG_DEFAULT_LEVEL 8
+//Filter value that picks one per row
+#define PNG_FILTER_AUTO -1
+
+//Indexed PNG writer, indices are stored with the smallest bit depth (1, 2, 4 or 8) that holds k colors instead of 3 or 4 bytes per pixel.
+//The row buffers are kept between writes, a writer can be used by one thread at a time
+class PNGWriter
+{
+public:
+	int level;  //Deflate level given to stbi_zlib_compress
+	int filter; //PNG row filter (0 none, 1 sub, 2 up) or PNG_FILTER_AUTO
+
+	PNGWriter() : level(PNG_DEFAULT_LEVEL), filter(PNG_FILTER_AUTO) {}
+
+	//indices are w * h palette indices below k (k <= 256). alpha has k entries or is 0 for an opaque palette, it is written as a tRNS chunk
+	bool Write(const char* path, const unsigned char* indices, int w, int h, const ColorRGB* palette, int k, const unsigned char* alpha = 0);
+
+	//Palettes up to 256 colors
+	bool Write(const char* path, const IndexedImage& img);
+
+	static int BitDepth(int k);
+
+private:
+	std::vector< unsigned char > packed;
+	std::vector< unsigned char > filtered;
+	std::vector< unsigned char > candidate;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "PaletteFile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <vector>
+
+static bool HasExtension(const char* path, const char* ext)
+{
+	const char* dot = strrchr(path, '.');
+	if(!dot)
+		return false;
+
+	for(++ dot; *dot && *ext; ++dot, ++ext)
+	{
+		if(tolower(*dot) != *ext)
+			return false;
+	}
+	return !*dot && !*ext;
+}
+
+static ColorRGB* ToPalette(const std::vector< ColorRGB >& colors, int& k)
+{
+	if(colors.empty() || colors.size() > PALETTE_MAX_COLORS)
+		return 0;
+
+	k = (int)colors.size();
+	ColorRGB* palette = new ColorRGB[k];
+	for(int c = 0; c < k; ++c)
+		palette[c] = colors[c];
+	return palette;
+}
+
+//"GIMP Palette" header, optional Name:/Columns: lines, # comments and "R G B name" lines
+static ColorRGB* LoadGPL(FILE* file, int& k)
+{
+	char line[1024];
+	if(!fgets(line, sizeof(line), file) || strncmp(line, "GIMP Palette", 12))
+		return 0;
+
+	std::vector< ColorRGB > colors;
+	while(fgets(line, sizeof(line), file))
+	{
+		int r, g, b;
+		if(line[0] == '#' || sscanf(line, "%d %d %d", &r, &g, &b) != 3)
+			continue;
+		colors.push_back(ColorRGB((unsigned char)Clamp(r, 0, 255), (unsigned char)Clamp(g, 0, 255), (unsigned char)Clamp(b, 0, 255)));
+	}
+	return ToPalette(colors, k);
+}
+
+//768 bytes with 256 RGB colors, optionally followed by the number of colors in use (big endian 16 bit) and the transparent index
+static ColorRGB* LoadACT(FILE* file, int& k)
+{
+	unsigned char data[772];
+	size_t size = fread(data, 1, sizeof(data), file);
+	if(size != 768 && size != 772)
+		return 0;
+
+	int num_colors = 256;
+	if(size == 772)
+	{
+		num_colors = (data[768] << 8) | data[769];
+		if(num_colors == 0 || num_colors > 256)
+			num_colors = 256;
+	}
+
+	std::vector< ColorRGB > colors;
+	for(int c = 0; c < num_colors; ++c)
+		colors.push_back(ColorRGB(data[c * 3], data[c * 3 + 1], data[c * 3 + 2]));
+	return ToPalette(colors, k);
+}
+
+//One RRGGBB color per line, with or without #, lines starting with ; or // are comments
+static ColorRGB* LoadHex(FILE* file, int& k)
+{
+	std::vector< ColorRGB > colors;
+	char line[1024];
+	while(fgets(line, sizeof(line), file))
+	{
+		const char* it = line;
+		while(isspace((unsigned char)*it))
+			it ++;
+		if(*it == ';' || (it[0] == '/' && it[1] == '/') || !*it)
+			continue;
+		if(*it == '#')
+			it ++;
+
+		int digits = 0;
+		while(isxdigit((unsigned char)it[digits]))
+			digits ++;
+		if(digits != 6)
+			return 0;
+
+		char hex[7];
+		memcpy(hex, it, 6);
+		hex[6] = 0;
+		unsigned int value = (unsigned int)strtoul(hex, 0, 16);
+		colors.push_back(ColorRGB((unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value));
+	}
+	return ToPalette(colors, k);
+}
+
+//Distinct colors of the image in scan order
+static ColorRGB* LoadSwatch(const char* path, int& k)
+{
+	Image image(path);
+	if(!image.data || image.depth < 3)
+		return 0;
+
+	std::vector< ColorRGB > colors;
+	std::vector< bool > seen(1 << 24, false);
+	for(int y = 0; y < image.h; ++y)
+	{
+		for(int x = 0; x < image.w; ++x)
+		{
+			ColorRGB color = image.Get(x, y);
+			int key = (color.R << 16) | (color.G << 8) | color.B;
+			if(!seen[key])
+			{
+				seen[key] = true;
+				colors.push_back(color);
+				if(colors.size() > PALETTE_MAX_COLORS)
+					return 0;
+			}
+		}
+	}
+	return ToPalette(colors, k);
+}
+
+ColorRGB* LoadPalette(const char* path, int& k)
+{
+	bool act = HasExtension(path, "act");
+	bool text = HasExtension(path, "gpl") || HasExtension(path, "hex") || HasExtension(path, "txt");
+	if(!act && !text)
+		return LoadSwatch(path, k);
+
+	FILE* file = fopen(path, act ? "rb" : "r");
+	if(!file)
+		return 0;
+
+	ColorRGB* palette = 0;
+	if(act)
+	{
+		palette = LoadACT(file, k);
+	}
+	else
+	{
+		//GIMP palettes are recognized by their header whatever their extension
+		palette = LoadGPL(file, k);
+		if(!palette)
+		{
+			rewind(file);
+			palette = LoadHex(file, k);
+		}
+	}
+	fclose(file);
+	return palette;
+}
+
+bool SavePalette(const char* path, const ColorRGB* palette, int k)
+{
+	FILE* file = fopen(path, "w");
+	if(!file)
+		return false;
+
+	bool ok = fprintf(file, "GIMP Palette\nName: ZIMGQuant\n#\n") > 0;
+	for(int c = 0; c < k && ok; ++c)
+		ok = fprintf(file, "%3d %3d %3d\tIndex %d\n", palette[c].R, palette[c].G, palette[c].B, c) > 0;
+	return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,16 @@
+#ifndef PALETTEFILE_H
+#define PALETTEFILE_H
+
+#include "Image.h"
+
+#define PALETTE_MAX_COLORS 65535
+
+//Reads a palette from a GIMP palette (.gpl), Adobe color table (.act), list of hex colors (.hex or .txt, "#RRGGBB" or "RRGGBB" per line)
+//or an image whose distinct colors, in order of appearance, are the palette (PNG swatches).
+//Returns 0 if the file can't be read, the palette must be deleted with delete[]
+ColorRGB* LoadPalette(const char* path, int& k);
+
+//Writes a GIMP palette that LoadPalette reads back
+bool SavePalette(const char* path, const ColorRGB* palette, int k);
+
+#endif
@@ -0,0 +1,196 @@
+#include "SIMDPalette.h"
+#include <climits>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+//Padding entries, far enough to never be the closest color
+#define PAD_COLOR 1024
+
+SIMDLevel DetectSIMD()
+{
+#if defined(SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	bool avx2 = false;
+	if(os_avx && max_leaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	if(avx2)
+		return SIMD_AVX2;
+	if(sse41)
+		return SIMD_SSE41;
+#elif defined(SIMD_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if(__builtin_cpu_supports("sse4.1"))
+		return SIMD_SSE41;
+#endif
+	return SIMD_None;
+}
+
+std::string CPUName()
+{
+	char brand[49] = { 0 };
+#if defined(SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0x80000000);
+	if((unsigned int)info[0] >= 0x80000004)
+	{
+		for(int i = 0; i < 3; ++i)
+		{
+			__cpuid(info, 0x80000002 + i);
+			memcpy(brand + i * 16, info, 16);
+		}
+	}
+#elif defined(SIMD_X86)
+	unsigned int info[4];
+	if(__get_cpuid_max(0x80000000, 0) >= 0x80000004)
+	{
+		for(int i = 0; i < 3; ++i)
+		{
+			__get_cpuid(0x80000002 + i, &info[0], &info[1], &info[2], &info[3]);
+			memcpy(brand + i * 16, info, 16);
+		}
+	}
+#endif
+	//Trim the padding spaces
+	std::string ret(brand);
+	size_t begin = ret.find_first_not_of(' ');
+	size_t end = ret.find_last_not_of(' ');
+	return begin == std::string::npos ? std::string() : ret.substr(begin, end - begin + 1);
+}
+
+void SIMDPalette::Reset(const ColorRGB* palette, int k, SIMDLevel level)
+{
+	this->k = k;
+	this->level = level;
+
+	colors.assign(palette, palette + k);
+
+	int padded_k = (k + 15) & ~15;
+	rg.assign(padded_k, PAD_COLOR | (PAD_COLOR << 16));
+	b.assign(padded_k, PAD_COLOR);
+	for(int c = 0; c < k; ++c)
+	{
+		rg[c] = palette[c].R | (palette[c].G << 16);
+		b[c] = palette[c].B;
+	}
+}
+
+#ifdef SIMD_X86
+//Each lane keeps the first index with its minimum distance, pick the lowest index among the lanes sharing the global minimum
+static int ArgMin(const int* dists, const int* idxs, int lanes)
+{
+	int best = 0;
+	for(int i = 1; i < lanes; ++i)
+	{
+		if(dists[i] < dists[best] || (dists[i] == dists[best] && idxs[i] < idxs[best]))
+			best = i;
+	}
+	return idxs[best];
+}
+
+TARGET_SSE41 static inline void StepSSE41(const int* rg, const int* b, __m128i pix_rg, __m128i pix_b, __m128i idx, __m128i& best_dist, __m128i& best_idx)
+{
+	__m128i d_rg = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)rg), pix_rg);
+	__m128i d_b = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)b), pix_b);
+	__m128i dist = _mm_add_epi32(_mm_madd_epi16(d_rg, d_rg), _mm_madd_epi16(d_b, d_b));
+
+	//Strict comparison so each lane keeps the first index on ties
+	__m128i closer = _mm_cmpgt_epi32(best_dist, dist);
+	best_dist = _mm_min_epi32(best_dist, dist);
+	best_idx = _mm_blendv_epi8(best_idx, idx, closer);
+}
+
+TARGET_SSE41 static int FindClosestSSE41(const int* rg, const int* b, int padded_k, const ColorRGB& color)
+{
+	const __m128i pix_rg = _mm_set1_epi32(color.R | (color.G << 16));
+	const __m128i pix_b = _mm_set1_epi32(color.B);
+	const __m128i step = _mm_set1_epi32(4);
+	__m128i best_dist = _mm_set1_epi32(INT_MAX);
+	__m128i best_idx = _mm_setzero_si128();
+	__m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+
+	//8 entries per iteration (padded_k is a multiple of 16)
+	for(int c = 0; c < padded_k; c += 8)
+	{
+		StepSSE41(rg + c, b + c, pix_rg, pix_b, idx, best_dist, best_idx);
+		idx = _mm_add_epi32(idx, step);
+		StepSSE41(rg + c + 4, b + c + 4, pix_rg, pix_b, idx, best_dist, best_idx);
+		idx = _mm_add_epi32(idx, step);
+	}
+
+	int dists[4], idxs[4];
+	_mm_storeu_si128((__m128i*)dists, best_dist);
+	_mm_storeu_si128((__m128i*)idxs, best_idx);
+	return ArgMin(dists, idxs, 4);
+}
+
+TARGET_AVX2 static inline void StepAVX2(const int* rg, const int* b, __m256i pix_rg, __m256i pix_b, __m256i idx, __m256i& best_dist, __m256i& best_idx)
+{
+	__m256i d_rg = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)rg), pix_rg);
+	__m256i d_b = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)b), pix_b);
+	__m256i dist = _mm256_add_epi32(_mm256_madd_epi16(d_rg, d_rg), _mm256_madd_epi16(d_b, d_b));
+
+	__m256i closer = _mm256_cmpgt_epi32(best_dist, dist);
+	best_dist = _mm256_min_epi32(best_dist, dist);
+	best_idx = _mm256_blendv_epi8(best_idx, idx, closer);
+}
+
+TARGET_AVX2 static int FindClosestAVX2(const int* rg, const int* b, int padded_k, const ColorRGB& color)
+{
+	const __m256i pix_rg = _mm256_set1_epi32(color.R | (color.G << 16));
+	const __m256i pix_b = _mm256_set1_epi32(color.B);
+	const __m256i step = _mm256_set1_epi32(8);
+	__m256i best_dist = _mm256_set1_epi32(INT_MAX);
+	__m256i best_idx = _mm256_setzero_si256();
+	__m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	//16 entries per iteration
+	for(int c = 0; c < padded_k; c += 16)
+	{
+		StepAVX2(rg + c, b + c, pix_rg, pix_b, idx, best_dist, best_idx);
+		idx = _mm256_add_epi32(idx, step);
+		StepAVX2(rg + c + 8, b + c + 8, pix_rg, pix_b, idx, best_dist, best_idx);
+		idx = _mm256_add_epi32(idx, step);
+	}
+
+	int dists[8], idxs[8];
+	_mm256_storeu_si256((__m256i*)dists, best_dist);
+	_mm256_storeu_si256((__m256i*)idxs, best_idx);
+	return ArgMin(dists, idxs, 8);
+}
+#endif
+
+int SIMDPalette::FindClosest(const ColorRGB& color) const
+{
+#ifdef SIMD_X86
+	if(level == SIMD_AVX2)
+		return FindClosestAVX2(&rg[0], &b[0], (int)rg.size(), color);
+	if(level == SIMD_SSE41)
+		return FindClosestSSE41(&rg[0], &b[0], (int)rg.size(), color);
+#endif
+	return ::FindClosest(color, const_cast< ColorRGB* >(&colors[0]), k);
+}
@@ -0,0 +1,41 @@
+#ifndef SIMDPALETTE_H
+#define SIMDPALETTE_H
+
+#include "Image.h"
+#include <vector>
+#include <string>
+
+enum SIMDLevel
+{
+	SIMD_None,
+	SIMD_SSE41,
+	SIMD_AVX2
+};
+
+//Best instruction set supported by the cpu running the program
+SIMDLevel DetectSIMD();
+
+//Brand string of the cpu, empty if unknown
+std::string CPUName();
+
+//Palette stored as structure of arrays for brute force nearest color search
+//R and G are packed as 16 bit pairs in one plane and B in another so the squared distance of each entry is two multiply-adds
+//Both planes are padded with far away colors up to a multiple of 16 entries
+class SIMDPalette
+{
+public:
+	std::vector< ColorRGB > colors;
+	std::vector< int > rg;
+	std::vector< int > b;
+	int k;
+	SIMDLevel level;
+
+	SIMDPalette() : k(0), level(SIMD_None) {}
+
+	void Reset(const ColorRGB* palette, int k, SIMDLevel level = DetectSIMD());
+
+	//Same result as FindClosest (the lowest index is returned on ties)
+	int FindClosest(const ColorRGB& color) const;
+};
+
+#endif
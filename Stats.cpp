@@ -0,0 +1,96 @@
+#include "Stats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+Stats::Stats() : w(0), h(0), depth(0), unique_colors(0), palette_size(0), kmeans_iterations(0),
+	load_ms(0), histogram_ms(0), octree_ms(0), palette_ms(0), kmeans_ms(0), lut_ms(0), tune_ms(0), mapping_ms(0), save_ms(0), peak_memory(0)
+{
+}
+
+double Stats::Total() const
+{
+	return load_ms + histogram_ms + octree_ms + palette_ms + kmeans_ms + lut_ms + tune_ms + mapping_ms + save_ms;
+}
+
+//Quoted and escaped for JSON
+static void PrintJSONString(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for(const unsigned char* c = (const unsigned char*)str; *c; ++c)
+	{
+		if(*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if(*c < 0x20)
+			fprintf(file, "\\u%04x", *c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+void Stats::Print(FILE* file, bool json, const char* name) const
+{
+	if(json)
+	{
+		if(name)
+		{
+			fprintf(file, "{\"input\": ");
+			PrintJSONString(file, name);
+			fprintf(file, ", ");
+		}
+		else
+		{
+			fprintf(file, "{");
+		}
+		fprintf(file, "\"width\": %d, \"height\": %d, \"depth\": %d, \"unique_colors\": %d, \"palette_size\": %d, \"kmeans_iterations\": %d, "
+			"\"load_ms\": %.3f, \"histogram_ms\": %.3f, \"octree_ms\": %.3f, \"palette_ms\": %.3f, \"kmeans_ms\": %.3f, \"lut_ms\": %.3f, \"tune_ms\": %.3f, \"mapping_ms\": %.3f, \"save_ms\": %.3f, \"total_ms\": %.3f",
+			w, h, depth, unique_colors, palette_size, kmeans_iterations,
+			load_ms, histogram_ms, octree_ms, palette_ms, kmeans_ms, lut_ms, tune_ms, mapping_ms, save_ms, Total());
+		if(peak_memory)
+			fprintf(file, ", \"peak_memory\": %lld", peak_memory);
+		fprintf(file, "}\n");
+	}
+	else
+	{
+		if(name)
+			fprintf(file, "%s\n", name);
+		fprintf(file, "Image %dx%dx%d, %d unique colors, %d palette colors\n", w, h, depth, unique_colors, palette_size);
+		fprintf(file, "Load %.3fms\n", load_ms);
+		fprintf(file, "Histogram %.3fms\n", histogram_ms);
+		fprintf(file, "Octree %.3fms\n", octree_ms);
+		fprintf(file, "Palette %.3fms\n", palette_ms);
+		fprintf(file, "KMeans %.3fms (%d iterations)\n", kmeans_ms, kmeans_iterations);
+		fprintf(file, "LUT %.3fms\n", lut_ms);
+		fprintf(file, "Tune %.3fms\n", tune_ms);
+		fprintf(file, "Mapping %.3fms\n", mapping_ms);
+		fprintf(file, "Save %.3fms\n", save_ms);
+		fprintf(file, "Done %.3fms\n", Total());
+		if(peak_memory)
+			fprintf(file, "Peak memory %.1fMB\n", peak_memory / (1024.0 * 1024.0));
+	}
+}
+
+long long PeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (long long)counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss; //Bytes on macOS
+#else
+	return (long long)usage.ru_maxrss * 1024; //Kilobytes on Linux
+#endif
+#endif
+}
@@ -0,0 +1,60 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdio>
+
+class Timer
+{
+public:
+	std::chrono::steady_clock::time_point start;
+
+	Timer()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		start = std::chrono::steady_clock::now();
+	}
+
+	//Milliseconds since the last reset
+	double Elapsed() const
+	{
+		return std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+//Time spent on each stage of a quantization plus a summary of the input and output
+class Stats
+{
+public:
+	int w, h, depth;
+	int unique_colors;
+	int palette_size;
+	int kmeans_iterations;
+
+	double load_ms;
+	double histogram_ms;
+	double octree_ms;
+	double palette_ms;
+	double kmeans_ms;
+	double lut_ms;
+	double tune_ms; //Nearest color backend measurements of -nearest auto, not included in kmeans_ms and mapping_ms
+	double mapping_ms;
+	double save_ms;
+
+	long long peak_memory; //Peak resident memory of the process in bytes, 0 if unknown or not measured (batch images), then it isn't printed
+
+	Stats();
+
+	double Total() const;
+	//name is the input file, printed first when given
+	void Print(FILE* file, bool json, const char* name = 0) const;
+};
+
+//Largest working set the process has had so far, in bytes
+long long PeakMemory();
+
+#endif
@@ -0,0 +1,87 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int num_threads) : task(0), num_tasks(0), next_task(0), pending_tasks(0), batch(0), quit(false)
+{
+	if(num_threads <= 0)
+		num_threads = HardwareThreads();
+
+	for(int i = 1; i < num_threads; ++i)
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	start_cond.notify_all();
+
+	for(size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+int ThreadPool::HardwareThreads()
+{
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+void ThreadPool::Run(int num_tasks, const std::function< void(int) >& task)
+{
+	if(workers.empty() || num_tasks == 1)
+	{
+		for(int i = 0; i < num_tasks; ++i)
+			task(i);
+		return;
+	}
+
+	std::unique_lock< std::mutex > lock(mutex);
+	this->task = &task;
+	this->num_tasks = num_tasks;
+	next_task = 0;
+	pending_tasks = num_tasks;
+	batch ++;
+	start_cond.notify_all();
+
+	RunTasks(lock, batch);
+	while(pending_tasks > 0)
+		done_cond.wait(lock);
+
+	this->task = 0;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	//Workers are created before any batch, a batch started before this thread runs must still be picked
+	std::unique_lock< std::mutex > lock(mutex);
+	unsigned int last_batch = 0;
+	while(true)
+	{
+		while(!quit && batch == last_batch)
+			start_cond.wait(lock);
+
+		if(quit)
+			return;
+
+		last_batch = batch;
+		RunTasks(lock, last_batch);
+	}
+}
+
+void ThreadPool::RunTasks(std::unique_lock< std::mutex >& lock, unsigned int batch)
+{
+	//Tasks are taken with the lock held so a late thread never picks a task from a newer batch
+	while(batch == this->batch && next_task < num_tasks)
+	{
+		int i = next_task ++;
+		const std::function< void(int) >& f = *task;
+
+		lock.unlock();
+		f(i);
+		lock.lock();
+
+		if(-- pending_tasks == 0)
+			done_cond.notify_all();
+	}
+}
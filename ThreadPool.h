@@ -0,0 +1,46 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//Fixed set of worker threads running batches of tasks
+class ThreadPool
+{
+public:
+	//0 threads uses all the cores available
+	ThreadPool(int num_threads);
+	~ThreadPool();
+
+	//Total threads running tasks, including the one calling Run
+	int NumThreads() const
+	{
+		return (int)workers.size() + 1;
+	}
+
+	//Runs task(0) ... task(num_tasks - 1) and waits until all of them are done
+	void Run(int num_tasks, const std::function< void(int) >& task);
+
+	static int HardwareThreads();
+
+private:
+	std::vector< std::thread > workers;
+	std::mutex mutex;
+	std::condition_variable start_cond;
+	std::condition_variable done_cond;
+
+	const std::function< void(int) >* task;
+	int num_tasks;
+	int next_task;
+	int pending_tasks;
+	unsigned int batch;
+	bool quit;
+
+	void WorkerLoop();
+	void RunTasks(std::unique_lock< std::mutex >& lock, unsigned int batch);
+};
+
+#endif
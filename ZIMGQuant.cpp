@@ -1,23 +1,621 @@
 #include "Image.h"
 #include "KMeans.h"
 #include "Octree.h"
+#include "Histogram.h"
+#include "Stats.h"
+#include "NearestColor.h"
+#include "ColorLUT.h"
+#include "PaletteFile.h"
+#include "PNGWriter.h"
+#include "IndexedImage.h"
+#include "ImageStream.h"
+#include "BandMapper.h"
+#include "ThreadPool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define NOMINMAX
 #include <windows.h>
+#else
+#include <dirent.h>
+#endif
 
-long long milliseconds_now() {
-    static LARGE_INTEGER s_frequency;
-    static BOOL s_use_qpc = QueryPerformanceFrequency(&s_frequency);
-    if (s_use_qpc) {
-        LARGE_INTEGER now;
-        QueryPerformanceCounter(&now);
-        return (1000LL * now.QuadPart) / s_frequency.QuadPart;
-    } else {
-        return GetTickCount();
-    }
+void InputError()
+{
+	printf("Usage: ZIMGQuant <image, directory or @list file> -colors <num colors> -dithering <0 or 1> -output <output path or directory> -method <octree, kmeans or minibatch> [-palette <gpl, act, hex or image file>] [-bounded <0 or 1>] [-threads <num threads, 0 for all cores>] [-jobs <images quantized at once, 0 for all cores>] [-output_ext <png, ppm, pam, ff, raw or idx>] [-octree_leaves <max leaves>] [-sample <max palette pixels>] [-sample_mode <stratified or resize>] [-iterations <max kmeans iterations>] [-tolerance <min relative SSE improvement>] [-deadline <kmeans time budget in ms>] [-batch_size <colors per batch>] [-batches <num batches>] [-polish <0 or 1>] [-nearest <auto, scalar, simd, kdtree, grid or lut>] [-tune_cache <path>] [-lut <lut file>] [-stream <rows per band>] [-raw <width>x<height>x<depth>] [-indexed <0 or 1>] [-png_level <deflate level>] [-png_filter <auto, none, sub or up>] [-stats <text, json or none>]\n");
 }
 
-void InputError()
+enum Method
+{
+	Method_KMeans,
+	Method_MiniBatch,
+	Method_Octree
+};
+
+enum SampleMode
+{
+	Sample_Stratified,
+	Sample_Resize
+};
+
+enum StatsFormat
+{
+	Stats_Text,
+	Stats_JSON,
+	Stats_None
+};
+
+//Settings of the command line, the same for every image of a batch
+class Options
+{
+public:
+	int k;
+	bool dithering;
+	Method method;
+	KMeansOptions kmeans_options;
+	int octree_leaves;
+	long long sample_pixels;
+	SampleMode sample_mode;
+	bool indexed;
+	int png_level;
+	int png_filter;
+	int stream_rows;
+	int raw_w, raw_h, raw_depth;
+	StatsFormat stats_format;
+
+	ColorRGB* palette;    //Fixed palette of k colors, 0 to make one per image
+	const char* lut_path; //LUT built for each image, only without a fixed palette
+	const ColorLUT* lut;  //LUT of the fixed palette, shared by every image
+
+	Options() : k(-1), dithering(true), method(Method_KMeans), octree_leaves(0), sample_pixels(0), sample_mode(Sample_Stratified), indexed(true),
+		png_level(PNG_DEFAULT_LEVEL), png_filter(PNG_FILTER_AUTO), stream_rows(0), raw_w(0), raw_h(0), raw_depth(3), stats_format(Stats_Text),
+		palette(0), lut_path(0), lut(0) {}
+};
+
+//Memory a batch worker keeps from one image to the next, so after the first images its tables and planes are only grown for bigger ones.
+//Decoded pixels can't be kept, stb_image allocates a new buffer for every image
+class Workspace
+{
+public:
+	Histogram histogram;
+	Octree octree;
+	KMeansBuffers kmeans;
+	NearestColor nearest;
+	IndexedImage indexed;
+	PNGWriter png_writer;
+	ThreadPool* pool; //Threads of kmeans and mapping, 0 with one thread
+
+	Workspace(const Options& options)
+	{
+		png_writer.level = options.png_level;
+		png_writer.filter = options.png_filter;
+		pool = options.kmeans_options.num_threads != 1 ? new ThreadPool(options.kmeans_options.num_threads) : 0;
+		kmeans.pool = pool;
+	}
+
+	~Workspace()
+	{
+		delete pool;
+	}
+
+private:
+	Workspace(const Workspace&);
+	Workspace& operator=(const Workspace&);
+};
+
+//Palette of the image (a copy of the fixed one when there is one), freed with delete[]
+static ColorRGB* FixedPalette(const Options& options)
+{
+	ColorRGB* palette = new ColorRGB[options.k];
+	std::copy(options.palette, options.palette + options.k, palette);
+	return palette;
+}
+
+//Moves the time this thread spent tuning the nearest color search since tune_start out of a stage into tune_ms
+static void TakeTuneTime(double tune_start, double& stage_ms, Stats& stats)
+{
+	double tune_ms = NearestTuner::ThreadTuneMs() - tune_start;
+	stage_ms -= tune_ms;
+	stats.tune_ms += tune_ms;
+}
+
+//Octree palette refined by kmeans or minibatch kmeans
+static ColorRGB* PaletteFromHistogram(const Histogram& histogram, const Options& options, Workspace& workspace, Stats& stats)
+{
+	Timer timer;
+	Octree& octree = workspace.octree;
+	octree.max_leaves = options.octree_leaves ? std::max(options.octree_leaves, options.k) : 0;
+	octree.Clear();
+	octree.AddHistogram(histogram);
+	stats.octree_ms = timer.Elapsed();
+
+	timer.Reset();
+	ColorRGB* palette = octree.GetPalette(options.k);
+	stats.palette_ms = timer.Elapsed();
+
+	double tune_start = NearestTuner::ThreadTuneMs();
+	if(options.method == Method_KMeans)
+	{
+		timer.Reset();
+		stats.kmeans_iterations = KMeansIterate(histogram, palette, options.k, options.kmeans_options, workspace.kmeans);
+		stats.kmeans_ms = timer.Elapsed();
+	}
+	else if(options.method == Method_MiniBatch)
+	{
+		timer.Reset();
+		stats.kmeans_iterations = MiniBatchKMeansIterate(histogram, palette, options.k, options.kmeans_options, workspace.kmeans);
+		stats.kmeans_ms = timer.Elapsed();
+	}
+	TakeTuneTime(tune_start, stats.kmeans_ms, stats);
+	return palette;
+}
+
+//Quantizes a PPM, PAM, farbfeld or raw file read band_rows rows at a time into another one, so memory doesn't depend on the image height.
+//The first pass collects the colors (skipped with a fixed palette) and the second one maps and writes each band
+static bool QuantizeStream(const char* input_path, const char* output_path, const Options& options, Workspace& workspace, Stats& stats)
+{
+	Timer timer;
+	StreamReader reader;
+	if(!reader.Open(input_path, options.raw_w, options.raw_h, options.raw_depth))
+	{
+		printf("Error loading %s\n", input_path);
+		return false;
+	}
+	StreamFormat output_format = StreamFormatFromPath(output_path);
+	if(output_format == Stream_None || output_format == Stream_Indices)
+	{
+		printf("Streaming writes .ppm, .pam, .ff or .raw files\n");
+		return false;
+	}
+	stats.w = reader.w;
+	stats.h = reader.h;
+	stats.depth = reader.depth;
+
+	Image band(reader.w, std::min(options.stream_rows, reader.h), reader.depth);
+	int max_band_rows = band.h;
+	stats.load_ms = timer.Elapsed();
+
+	int k = options.k;
+	ColorRGB* palette = 0;
+	if(options.palette)
+	{
+		palette = FixedPalette(options);
+	}
+	else
+	{
+		//Sampling takes the same share of pixels of each band
+		long long num_pixels = (long long)reader.w * reader.h;
+		bool sampled = options.sample_pixels > 0 && num_pixels > options.sample_pixels;
+		bool octree_only = options.method == Method_Octree && options.octree_leaves && !sampled;
+		Octree& octree = workspace.octree;
+		Histogram& histogram = workspace.histogram;
+		octree.max_leaves = octree_only ? std::max(options.octree_leaves, k) : 0;
+		octree.Clear();
+		histogram.Clear();
+
+		while(true)
+		{
+			timer.Reset();
+			band.h = max_band_rows;
+			if(!reader.ReadBand(band))
+				break;
+			stats.load_ms += timer.Elapsed();
+
+			timer.Reset();
+			if(octree_only)
+			{
+				octree.AddImage(band);
+				stats.octree_ms += timer.Elapsed();
+			}
+			else
+			{
+				if(sampled)
+					histogram.AddStratified(band, std::max(1LL, (long long)band.w * band.h * options.sample_pixels / num_pixels));
+				else
+					histogram.AddImage(band);
+				stats.histogram_ms += timer.Elapsed();
+			}
+		}
+
+		if(octree_only)
+		{
+			timer.Reset();
+			palette = octree.GetPalette(k);
+			stats.palette_ms = timer.Elapsed();
+		}
+		else
+		{
+			timer.Reset();
+			histogram.Finish();
+			stats.histogram_ms += timer.Elapsed();
+			stats.unique_colors = (int)histogram.entries.size();
+			palette = PaletteFromHistogram(histogram, options, workspace, stats);
+		}
+
+		if(!reader.Rewind())
+		{
+			printf("Error reading %s\n", input_path);
+			delete[] palette;
+			return false;
+		}
+	}
+	stats.palette_size = k;
+
+	StreamWriter writer;
+	if(!writer.Open(output_path, output_format, reader.w, reader.h, reader.depth))
+	{
+		printf("Error writing %s\n", output_path);
+		delete[] palette;
+		return false;
+	}
+
+	BandMapper mapper(palette, k, reader.w, reader.h, options.dithering, options.kmeans_options.num_threads, options.kmeans_options.nearest);
+	bool ok = true;
+	while(ok)
+	{
+		timer.Reset();
+		band.h = max_band_rows;
+		if(!reader.ReadBand(band))
+			break;
+		stats.load_ms += timer.Elapsed();
+
+		timer.Reset();
+		double tune_start = NearestTuner::ThreadTuneMs();
+		mapper.SetPalette(band);
+		stats.mapping_ms += timer.Elapsed();
+		TakeTuneTime(tune_start, stats.mapping_ms, stats);
+
+		timer.Reset();
+		ok = writer.WriteBand(band);
+		stats.save_ms += timer.Elapsed();
+	}
+
+	timer.Reset();
+	ok = writer.Close() && ok;
+	stats.save_ms += timer.Elapsed();
+	if(!ok)
+		printf("Error writing %s\n", output_path);
+
+	delete[] palette;
+	return ok;
+}
+
+//Loads, quantizes and saves one image, the output format is given by its extension
+static bool QuantizeFile(const char* input_path, const char* output_path, const Options& options, Workspace& workspace, Stats& stats)
+{
+	if(options.stream_rows > 0)
+		return QuantizeStream(input_path, output_path, options, workspace, stats);
+
+	Timer timer;
+	Image img(input_path, options.raw_w, options.raw_h, options.raw_depth);
+	if(!img.data)
+	{
+		printf("Error loading %s\n", input_path);
+		return false;
+	}
+	stats.load_ms = timer.Elapsed();
+	stats.w = img.w;
+	stats.h = img.h;
+	stats.depth = img.depth;
+
+	//The palette is estimated from at most sample_pixels pixels, the whole image is mapped
+	int k = options.k;
+	long long sample_pixels = options.sample_pixels;
+	bool sampled = sample_pixels > 0 && (long long)img.w * img.h > sample_pixels;
+
+	ColorRGB* palette = 0;
+	if(options.palette)
+	{
+		//Fixed palette, only mapping is left
+		palette = FixedPalette(options);
+	}
+	else if(options.method == Method_Octree && options.octree_leaves && !sampled)
+	{
+		timer.Reset();
+		Octree& octree = workspace.octree;
+		octree.max_leaves = std::max(options.octree_leaves, k);
+		octree.Clear();
+		octree.AddImage(img);
+		stats.octree_ms = timer.Elapsed();
+
+		timer.Reset();
+		palette = octree.GetPalette(k);
+		stats.palette_ms = timer.Elapsed();
+	}
+	else
+	{
+		timer.Reset();
+		Histogram& histogram = workspace.histogram;
+		histogram.Clear();
+		if(sampled && options.sample_mode == Sample_Resize)
+		{
+			double scale = sqrt((double)sample_pixels / ((double)img.w * img.h));
+			Image small(img, std::max(1, (int)(img.w * scale)), std::max(1, (int)(img.h * scale)));
+			histogram.AddImage(small);
+		}
+		else if(sampled)
+		{
+			histogram.AddStratified(img, sample_pixels);
+		}
+		else
+		{
+			histogram.AddImage(img);
+		}
+		histogram.Finish();
+		stats.histogram_ms = timer.Elapsed();
+		stats.unique_colors = (int)histogram.entries.size();
+
+		palette = PaletteFromHistogram(histogram, options, workspace, stats);
+	}
+	stats.palette_size = k;
+
+	//Opaque images saved as indexed PNG or uncompressed (PPM, PAM, farbfeld, raw or indices) are mapped to palette indices, reusing the pixel buffer
+	//when possible, uncompressed outputs are filled from the palette. The rest have their colors replaced in place, images with transparent pixels
+	//keep their alpha channel and are saved as RGBA
+	StreamFormat output_format = StreamFormatFromPath(output_path);
+	bool opaque = true;
+	if(img.depth == 4)
+	{
+		for(long long i = 3; i < (long long)img.w * img.h * 4 && opaque; i += 4)
+			opaque = img.data[i] == 255;
+	}
+	bool indexed;
+	if(output_format == Stream_None)
+		indexed = options.indexed && opaque && k <= 256;
+	else
+		indexed = opaque || output_format == Stream_Indices;
+	IndexedImage& indexed_img = workspace.indexed;
+
+	ColorLUT image_lut;
+	const ColorLUT* lut = options.lut;
+	if(!lut && options.lut_path)
+	{
+		//Mapped from the file when it was built for this palette, built and saved otherwise
+		timer.Reset();
+		if(!image_lut.Load(options.lut_path, palette, k))
+		{
+			image_lut.Build(palette, k, false, options.kmeans_options.num_threads);
+			if(!image_lut.Save(options.lut_path))
+				printf("Error writing %s\n", options.lut_path);
+		}
+		lut = &image_lut;
+		stats.lut_ms = timer.Elapsed();
+	}
+
+	timer.Reset();
+	double tune_start = NearestTuner::ThreadTuneMs();
+	int num_threads = options.kmeans_options.num_threads;
+	if(lut && indexed)
+		img.Map(*lut, options.dithering, indexed_img, num_threads, true, workspace.pool);
+	else if(lut)
+		img.SetPalette(*lut, options.dithering, num_threads, workspace.pool);
+	else if(indexed)
+		img.Map(palette, k, options.dithering, indexed_img, num_threads, options.kmeans_options.nearest, true, &workspace.nearest, workspace.pool);
+	else
+		img.SetPalette(palette, k, options.dithering, num_threads, options.kmeans_options.nearest, &workspace.nearest, workspace.pool);
+	stats.mapping_ms = timer.Elapsed();
+	TakeTuneTime(tune_start, stats.mapping_ms, stats);
+
+	//The source pixels aren't needed anymore if they weren't reused
+	if(indexed)
+		img.Free();
+
+	timer.Reset();
+	bool saved = true;
+	if(output_format == Stream_Indices)
+	{
+		//The palette goes next to the indices
+		std::string palette_output = std::string(output_path) + ".gpl";
+		saved = WriteMapped(output_path, output_format, indexed_img) && SavePalette(palette_output.c_str(), palette, k);
+	}
+	else if(output_format != Stream_None && indexed)
+	{
+		saved = WriteMapped(output_path, output_format, indexed_img, stats.depth);
+	}
+	else if(output_format != Stream_None)
+	{
+		saved = WriteMapped(output_path, output_format, img);
+	}
+	else if(indexed)
+	{
+		saved = workspace.png_writer.Write(output_path, indexed_img);
+	}
+	else
+	{
+		img.Save(output_path);
+	}
+	if(!saved)
+		printf("Error writing %s\n", output_path);
+	stats.save_ms = timer.Elapsed();
+
+	delete[] palette;
+	return saved;
+}
+
+//An input of a batch and where its result goes
+class BatchItem
 {
-	printf("Usage: ZIMGQuant <image> -colors <num colors> -dithering <0 or 1> -output <output path> -method <octree or kmeans>\n");
+public:
+	std::string input;
+	std::string output;
+};
+
+static bool IsDirectory(const char* path)
+{
+	struct stat info;
+	return stat(path, &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+//Extensions read by Image::Load, lowercase
+static bool IsImageFile(const std::string& name)
+{
+	static const char* extensions[] = {"png", "jpg", "jpeg", "bmp", "tga", "gif", "psd", "hdr", "pic", "pnm", "ppm", "pgm", "pam", "ff"};
+
+	size_t dot = name.rfind('.');
+	if(dot == std::string::npos)
+		return false;
+	std::string extension = name.substr(dot + 1);
+	for(size_t i = 0; i < extension.size(); ++i)
+		extension[i] = (char)tolower((unsigned char)extension[i]);
+	for(size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+	{
+		if(extension == extensions[i])
+			return true;
+	}
+	return false;
+}
+
+//Image files of a directory (not its subdirectories) sorted by name
+static bool ListDirectory(const std::string& path, std::vector< std::string >& files)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+	if(find == INVALID_HANDLE_VALUE)
+		return false;
+	do
+	{
+		if(!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && IsImageFile(data.cFileName))
+			files.push_back(path + "/" + data.cFileName);
+	}
+	while(FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* dir = opendir(path.c_str());
+	if(!dir)
+		return false;
+	while(dirent* entry = readdir(dir))
+	{
+		std::string file = path + "/" + entry->d_name;
+		struct stat info;
+		if(IsImageFile(entry->d_name) && stat(file.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFREG)
+			files.push_back(file);
+	}
+	closedir(dir);
+#endif
+	std::sort(files.begin(), files.end());
+	return true;
+}
+
+//output_dir/<input name with its extension replaced>
+static std::string OutputPath(const std::string& input, const std::string& output_dir, const std::string& output_ext)
+{
+	size_t slash = input.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	size_t dot = name.rfind('.');
+	if(dot != std::string::npos)
+		name.resize(dot);
+	return output_dir + "/" + name + "." + output_ext;
+}
+
+//Inputs of a directory or of a list file with one "input" or "input<tab>output" per line. Inputs without an output are written to output_dir.
+//Fails when two inputs would be written to the same output (a.png and a.jpg in the same directory), prints the error
+static bool ReadBatch(const char* source, const std::string& output_dir, const std::string& output_ext, std::vector< BatchItem >& items)
+{
+	std::vector< std::string > inputs, outputs;
+	if(source[0] == '@')
+	{
+		FILE* file = fopen(source + 1, "r");
+		if(!file)
+		{
+			printf("Error reading %s\n", source);
+			return false;
+		}
+
+		char line[4096];
+		while(fgets(line, sizeof(line), file))
+		{
+			std::string entry(line);
+			while(!entry.empty() && (entry.back() == '\n' || entry.back() == '\r'))
+				entry.pop_back();
+			if(entry.empty() || entry[0] == '#')
+				continue;
+
+			size_t tab = entry.find('\t');
+			inputs.push_back(entry.substr(0, tab));
+			outputs.push_back(tab == std::string::npos ? std::string() : entry.substr(tab + 1));
+		}
+		fclose(file);
+	}
+	else if(ListDirectory(source, inputs))
+	{
+		outputs.resize(inputs.size());
+	}
+	else
+	{
+		printf("Error reading %s\n", source);
+		return false;
+	}
+
+	std::map< std::string, size_t > first_input; //Item that writes each output
+	for(size_t i = 0; i < inputs.size(); ++i)
+	{
+		BatchItem item;
+		item.input = inputs[i];
+		item.output = outputs[i].empty() ? OutputPath(inputs[i], output_dir, output_ext) : outputs[i];
+
+		std::map< std::string, size_t >::iterator it = first_input.find(item.output);
+		if(it != first_input.end())
+		{
+			printf("Error: %s and %s are both written to %s\n", items[it->second].input.c_str(), item.input.c_str(), item.output.c_str());
+			return false;
+		}
+		first_input[item.output] = items.size();
+		items.push_back(item);
+	}
+	return true;
+}
+
+//Quantizes the items with num_jobs workers, each one with its own workspace, printing the stats of each image as it finishes.
+//Returns the number of images that failed
+static int RunBatch(const std::vector< BatchItem >& items, const Options& options, int num_jobs)
+{
+	ThreadPool pool(num_jobs);
+	int num_workers = std::max(1, std::min(pool.NumThreads(), (int)items.size()));
+	std::vector< Workspace* > workspaces;
+	for(int t = 0; t < num_workers; ++t)
+		workspaces.push_back(new Workspace(options));
+
+	std::atomic< int > next_item(0);
+	std::atomic< int > failed(0);
+	std::mutex print_mutex;
+	pool.Run(num_workers, [&](int t)
+	{
+		Workspace& workspace = *workspaces[t];
+		for(int i = next_item++; i < (int)items.size(); i = next_item++)
+		{
+			Stats stats;
+			//Peak memory is left out, it is the one of the whole process with the other workers. The summary reports it
+			bool ok = QuantizeFile(items[i].input.c_str(), items[i].output.c_str(), options, workspace, stats);
+			if(!ok)
+			{
+				failed ++;
+				continue;
+			}
+
+			if(options.stats_format != Stats_None)
+			{
+				std::lock_guard< std::mutex > lock(print_mutex);
+				stats.Print(stdout, options.stats_format == Stats_JSON, items[i].input.c_str());
+				fflush(stdout);
+			}
+		}
+	});
+
+	for(int t = 0; t < num_workers; ++t)
+		delete workspaces[t];
+	return failed;
 }
 
 int main(int argc, char* argv[])
@@ -28,60 +626,231 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	int k = -1;
-	bool dithering = true;
+	Options options;
+	KMeansOptions& kmeans_options = options.kmeans_options;
 	char* output_path = 0;
-	
-	enum Method
-	{
-		Method_KMeans,
-		Method_Octree
-	} 
-	method = Method_KMeans;
+	const char* palette_path = 0;
+	const char* output_ext = "png";
+	int num_jobs = 1;
 
 	for(int i = 2; i < argc; ++i)
 	{
 		if(!strcmp(argv[i], "-colors"))
 		{
-			k = atoi(argv[++ i]);
-		} 
+			options.k = atoi(argv[++ i]);
+			if(options.k <= 0)
+			{
+				printf("-colors must be a positive number\n");
+				InputError();
+				return -1;
+			}
+		}
 		else if(!strcmp(argv[i], "-dithering"))
 		{
-			dithering = atoi(argv[++ i]) == 0 ? false : true;
+			options.dithering = atoi(argv[++ i]) == 0 ? false : true;
 		}
 		else if(!strcmp(argv[i], "-output"))
 		{
 			output_path = argv[++ i];
 		}
+		else if(!strcmp(argv[i], "-output_ext"))
+		{
+			output_ext = argv[++ i];
+		}
+		else if(!strcmp(argv[i], "-jobs"))
+		{
+			num_jobs = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-bounded"))
+		{
+			kmeans_options.bounded = atoi(argv[++ i]) != 0;
+		}
+		else if(!strcmp(argv[i], "-threads"))
+		{
+			kmeans_options.num_threads = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-iterations"))
+		{
+			kmeans_options.max_iterations = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-tolerance"))
+		{
+			kmeans_options.tolerance = atof(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-deadline"))
+		{
+			kmeans_options.deadline_ms = atof(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-batch_size"))
+		{
+			kmeans_options.batch_size = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-batches"))
+		{
+			kmeans_options.num_batches = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-polish"))
+		{
+			kmeans_options.polish = atoi(argv[++ i]) != 0;
+		}
+		else if(!strcmp(argv[i], "-sample"))
+		{
+			options.sample_pixels = atoll(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-sample_mode"))
+		{
+			const char* sample_str = argv[++ i];
+			if(!strcmp(sample_str, "resize"))
+				options.sample_mode = Sample_Resize;
+			else
+				options.sample_mode = Sample_Stratified;
+		}
+		else if(!strcmp(argv[i], "-nearest"))
+		{
+			kmeans_options.nearest = NearestBackendFromName(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-palette"))
+		{
+			palette_path = argv[++ i];
+		}
+		else if(!strcmp(argv[i], "-lut"))
+		{
+			options.lut_path = argv[++ i];
+		}
+		else if(!strcmp(argv[i], "-stream"))
+		{
+			options.stream_rows = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-raw"))
+		{
+			sscanf(argv[++ i], "%dx%dx%d", &options.raw_w, &options.raw_h, &options.raw_depth);
+		}
+		else if(!strcmp(argv[i], "-indexed"))
+		{
+			options.indexed = atoi(argv[++ i]) != 0;
+		}
+		else if(!strcmp(argv[i], "-png_level"))
+		{
+			options.png_level = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-png_filter"))
+		{
+			const char* filter_str = argv[++ i];
+			if(!strcmp(filter_str, "none"))
+				options.png_filter = 0;
+			else if(!strcmp(filter_str, "sub"))
+				options.png_filter = 1;
+			else if(!strcmp(filter_str, "up"))
+				options.png_filter = 2;
+			else
+				options.png_filter = PNG_FILTER_AUTO;
+		}
+		else if(!strcmp(argv[i], "-tune_cache"))
+		{
+			NearestTuner::Global().cache_path = argv[++ i];
+		}
+		else if(!strcmp(argv[i], "-octree_leaves"))
+		{
+			options.octree_leaves = atoi(argv[++ i]);
+		}
+		else if(!strcmp(argv[i], "-stats"))
+		{
+			const char* stats_str = argv[++ i];
+			if(!strcmp(stats_str, "json"))
+				options.stats_format = Stats_JSON;
+			else if(!strcmp(stats_str, "none"))
+				options.stats_format = Stats_None;
+			else
+				options.stats_format = Stats_Text;
+		}
 		else if(!strcmp(argv[i], "-method"))
 		{
 			const char* method_str = argv[++ i];
 			if(!strcmp(method_str, "kmeans"))
-				method = Method_KMeans;
+				options.method = Method_KMeans;
+			else if(!strcmp(method_str, "minibatch"))
+				options.method = Method_MiniBatch;
 			else if(!strcmp(method_str, "octree"))
-				method = Method_Octree;
+				options.method = Method_Octree;
 		}
 	}
 
-	if(k == -1 || !output_path)
+	//A fixed palette sets the number of colors
+	if((options.k == -1 && !palette_path) || !output_path)
 	{
 		InputError();
 		return -1;
 	}
 
-	Image img(argv[1]);
+	//A directory or a list file quantizes every image it has, -output is then the directory of the results
+	bool batch = argv[1][0] == '@' || IsDirectory(argv[1]);
+	if(batch && options.lut_path && !palette_path)
+	{
+		printf("-lut needs -palette when quantizing several images\n");
+		return -1;
+	}
 
-	//img.Resize(160, 144);
+	//Work done once for every image
+	Stats setup_stats;
+	Timer timer;
 
-	long long start = milliseconds_now();
-	ColorRGB* palette = method == Method_KMeans ? KMeans(img, k) : OctreePalette(img, k);
-	img.SetPalette(palette, k, dithering);
-	long long elapsed = milliseconds_now() - start;
-	printf("Done %lldms\n", elapsed);
+	if(palette_path)
+	{
+		options.palette = LoadPalette(palette_path, options.k);
+		if(!options.palette)
+		{
+			printf("Error loading palette %s\n", palette_path);
+			return -1;
+		}
+		setup_stats.palette_ms = timer.Elapsed();
+	}
 
-	img.Save(output_path);
-	scanf("");
+	ColorLUT lut;
+	if(options.palette && options.lut_path)
+	{
+		//Mapped from the file when it was built for this palette, built and saved otherwise
+		timer.Reset();
+		if(!lut.Load(options.lut_path, options.palette, options.k))
+		{
+			lut.Build(options.palette, options.k, false, kmeans_options.num_threads);
+			if(!lut.Save(options.lut_path))
+				printf("Error writing %s\n", options.lut_path);
+		}
+		options.lut = &lut;
+		setup_stats.lut_ms = timer.Elapsed();
+	}
 
-    return 0;
-}
+	bool ok;
+	if(batch)
+	{
+		std::vector< BatchItem > items;
+		if(!ReadBatch(argv[1], output_path, output_ext, items))
+		{
+			delete[] options.palette;
+			return -1;
+		}
+
+		timer.Reset();
+		int failed = RunBatch(items, options, num_jobs);
+		double total_ms = timer.Elapsed();
+		ok = failed == 0;
 
+		if(options.stats_format == Stats_JSON)
+			printf("{\"images\": %d, \"failed\": %d, \"setup_ms\": %.3f, \"total_ms\": %.3f, \"peak_memory\": %lld}\n", (int)items.size(), failed, setup_stats.Total(), total_ms, PeakMemory());
+		else if(options.stats_format == Stats_Text)
+			printf("Batch %d images (%d failed) in %.3fms, setup %.3fms, %.1f images/s, peak memory %.1fMB\n", (int)items.size(), failed, total_ms, setup_stats.Total(),
+				total_ms > 0.0 ? items.size() * 1000.0 / total_ms : 0.0, PeakMemory() / (1024.0 * 1024.0));
+	}
+	else
+	{
+		Workspace workspace(options);
+		Stats stats(setup_stats);
+		ok = QuantizeFile(argv[1], output_path, options, workspace, stats);
+		stats.peak_memory = PeakMemory();
+		if(ok && options.stats_format != Stats_None)
+			stats.Print(stdout, options.stats_format == Stats_JSON);
+	}
+
+	delete[] options.palette;
+	return ok ? 0 : -1;
+}
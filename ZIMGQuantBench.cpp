@@ -0,0 +1,326 @@
+#include "Image.h"
+#include "KMeans.h"
+#include "Octree.h"
+#include "Histogram.h"
+#include "SIMDPalette.h"
+#include "InverseColormap.h"
+#include "FlatKDTree.h"
+#include "NearestColor.h"
+#include "Stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+//Deterministic pseudo random numbers so every run measures the same data
+class Random
+{
+public:
+	unsigned int state;
+
+	Random(unsigned int seed) : state(seed) {}
+
+	unsigned int Next()
+	{
+		state = state * 1664525u + 1013904223u;
+		return state >> 8;
+	}
+};
+
+//Smooth gradients plus noise, lots of unique colors like a photo
+static void FillImage(Image& img, unsigned int seed)
+{
+	Random random(seed);
+	for(int y = 0; y < img.h; ++y)
+	{
+		for(int x = 0; x < img.w; ++x)
+		{
+			size_t idx = img.GetIdx(x, y);
+			int noise = (int)(random.Next() % 33) - 16;
+			img.data[idx    ] = (unsigned char)Clamp(x * 255 / img.w + noise, 0, 255);
+			img.data[idx + 1] = (unsigned char)Clamp(y * 255 / img.h - noise, 0, 255);
+			img.data[idx + 2] = (unsigned char)Clamp((int)(127 + 120 * sin((x + y) * 0.02)) + noise / 2, 0, 255);
+		}
+	}
+}
+
+static void FillPalette(std::vector< ColorRGB >& palette, int k, unsigned int seed)
+{
+	Random random(seed);
+	palette.resize(k);
+	for(int c = 0; c < k; ++c)
+		palette[c] = ColorRGB(random.Next() & 0xFF, random.Next() & 0xFF, random.Next() & 0xFF);
+}
+
+class BenchResult
+{
+public:
+	std::vector< double > samples;
+
+	double Min() const { return *std::min_element(samples.begin(), samples.end()); }
+
+	double Median() const
+	{
+		std::vector< double > sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
+		size_t n = sorted.size();
+		return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+	}
+
+	double Mean() const
+	{
+		double sum = 0;
+		for(size_t i = 0; i < samples.size(); ++i)
+			sum += samples[i];
+		return sum / samples.size();
+	}
+
+	double StdDev() const
+	{
+		double mean = Mean();
+		double sum = 0;
+		for(size_t i = 0; i < samples.size(); ++i)
+			sum += (samples[i] - mean) * (samples[i] - mean);
+		return samples.size() > 1 ? sqrt(sum / (samples.size() - 1)) : 0.0;
+	}
+};
+
+class Bench
+{
+public:
+	int reps;
+	const char* filter;
+	long long checksum; //Keeps results alive so the compiler doesn't remove the work
+
+	Bench() : reps(5), filter(0), checksum(0)
+	{
+		//Items are pixels, except for builds (palette colors) and the octree and kmeans (unique colors)
+		printf("%-28s %7s %11s %10s %10s %10s %10s %10s %10s\n", "kernel", "colors", "size", "ns/item", "Mitems/s", "min ms", "median ms", "mean ms", "stddev ms");
+	}
+
+	bool Enabled(const char* name) const
+	{
+		return !filter || strstr(name, filter) != 0;
+	}
+
+	//setup runs untimed before each repetition, work is timed, items is the number of pixels (or colors) processed
+	template< class Setup, class Work >
+	void Run(const char* name, int k, int w, int h, long long items, Setup setup, Work work)
+	{
+		if(!Enabled(name))
+			return;
+
+		BenchResult result;
+		for(int r = 0; r < reps; ++r)
+		{
+			setup();
+			Timer timer;
+			work();
+			result.samples.push_back(timer.Elapsed());
+		}
+
+		Report(name, k, w, h, items, result);
+	}
+
+	void Report(const char* name, int k, int w, int h, long long items, const BenchResult& result)
+	{
+		double median = result.Median();
+		char size[32];
+		sprintf(size, "%dx%d", w, h);
+		printf("%-28s %7d %11s %10.2f %10.2f %10.3f %10.3f %10.3f %10.3f\n", name, k, size,
+			median * 1e6 / items, items / (median * 1e3), result.Min(), median, result.Mean(), result.StdDev());
+		fflush(stdout);
+	}
+};
+
+static void NoSetup() {}
+
+static void ParseList(const char* str, std::vector< int >& out)
+{
+	out.clear();
+	while(*str)
+	{
+		out.push_back(atoi(str));
+		while(*str && *str != ',')
+			str ++;
+		if(*str == ',')
+			str ++;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector< int > sizes;
+	std::vector< int > colors;
+	ParseList("256,1024,2048", sizes);
+	ParseList("2,4,8,16,32,64,128,256,512", colors);
+
+	//Every kernel gets an explicit backend, the tuner must not time anything or write its cache from here
+	NearestTuner::Global().cache_path.clear();
+
+	Bench bench;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(!strcmp(argv[i], "-sizes") && i + 1 < argc)
+			ParseList(argv[++ i], sizes);
+		else if(!strcmp(argv[i], "-colors") && i + 1 < argc)
+			ParseList(argv[++ i], colors);
+		else if(!strcmp(argv[i], "-reps") && i + 1 < argc)
+			bench.reps = std::max(1, atoi(argv[++ i]));
+		else if(!strcmp(argv[i], "-filter") && i + 1 < argc)
+			bench.filter = argv[++ i];
+		else
+		{
+			printf("Usage: ZIMGQuantBench [-sizes <w1,w2,...>] [-colors <k1,k2,...>] [-reps <repetitions>] [-filter <kernel name part>]\n");
+			return -1;
+		}
+	}
+
+	for(size_t s = 0; s < sizes.size(); ++s)
+	{
+		int w = sizes[s];
+		int h = sizes[s] * 3 / 4;
+		long long num_pixels = (long long)w * h;
+
+		Image source(w, h, 3);
+		FillImage(source, 1234);
+		Image img(w, h, 3);
+
+		Histogram histogram(source);
+		int n = (int)histogram.entries.size();
+
+		//Built here so the benches using the tree work when -filter skips Octree::Add.
+		//GetPalette merges nodes into their siblings, so each repetition works on a fresh copy
+		Octree built_octree;
+		built_octree.AddHistogram(histogram);
+
+		//Palette independent kernels
+		Octree octree;
+		bench.Run("Octree::Add", 0, w, h, n, [&]() { octree.Clear(); }, [&]() { octree.AddHistogram(histogram); });
+		bench.Run("Histogram", 0, w, h, num_pixels, NoSetup, [&]() { Histogram hist(source); bench.checksum += hist.entries.size(); });
+
+		for(size_t c = 0; c < colors.size(); ++c)
+		{
+			int k = colors[c];
+			std::vector< ColorRGB > palette;
+			FillPalette(palette, k, 42 + k);
+
+			bench.Run("FindClosest", k, w, h, num_pixels, NoSetup, [&]()
+			{
+				for(long long i = 0; i < num_pixels; ++i)
+				{
+					const unsigned char* p = source.data + i * 3;
+					bench.checksum += FindClosest(ColorRGB(p[0], p[1], p[2]), &palette[0], k);
+				}
+			});
+
+			SIMDPalette simd_palette;
+			simd_palette.Reset(&palette[0], k);
+			bench.Run("SIMDPalette::FindClosest", k, w, h, num_pixels, NoSetup, [&]()
+			{
+				for(long long i = 0; i < num_pixels; ++i)
+				{
+					const unsigned char* p = source.data + i * 3;
+					bench.checksum += simd_palette.FindClosest(ColorRGB(p[0], p[1], p[2]));
+				}
+			});
+
+			//Built once here too so the searches work when -filter skips the builds
+			InverseColormap inverse_colormap;
+			inverse_colormap.Build(&palette[0], k);
+			bench.Run("InverseColormap::Build", k, w, h, k, NoSetup, [&]() { inverse_colormap.Build(&palette[0], k); });
+			bench.Run("InverseColormap::Find", k, w, h, num_pixels, NoSetup, [&]()
+			{
+				for(long long i = 0; i < num_pixels; ++i)
+				{
+					const unsigned char* p = source.data + i * 3;
+					bench.checksum += inverse_colormap.FindClosest(ColorRGB(p[0], p[1], p[2]));
+				}
+			});
+
+			std::vector< KDTree > kd_tree_nodes(k);
+			for(int i = 0; i < k; ++i)
+				kd_tree_nodes[i].Reset(&palette[i], 0);
+			KDTree* kd_tree = KDTree::Build(&kd_tree_nodes[0], &kd_tree_nodes[0] + k, 0);
+			bench.Run("KDTree::Build", k, w, h, k, [&]()
+			{
+				for(int i = 0; i < k; ++i)
+					kd_tree_nodes[i].Reset(&palette[i], 0);
+			},
+			[&]() { kd_tree = KDTree::Build(&kd_tree_nodes[0], &kd_tree_nodes[0] + k, 0); });
+			bench.Run("KDTree::Nearest", k, w, h, num_pixels, NoSetup, [&]()
+			{
+				for(long long i = 0; i < num_pixels; ++i)
+				{
+					const unsigned char* p = source.data + i * 3;
+					bench.checksum += kd_tree->Nearest(ColorRGB(p[0], p[1], p[2]))->color - &palette[0];
+				}
+			});
+
+			FlatKDTree flat_kd_tree;
+			flat_kd_tree.Build(&palette[0], k);
+			bench.Run("FlatKDTree::Build", k, w, h, k, NoSetup, [&]() { flat_kd_tree.Build(&palette[0], k); });
+			bench.Run("FlatKDTree::Find", k, w, h, num_pixels, NoSetup, [&]()
+			{
+				//Seeded with the previous pixel like SetPalette does
+				int last = -1;
+				for(long long i = 0; i < num_pixels; ++i)
+				{
+					const unsigned char* p = source.data + i * 3;
+					last = flat_kd_tree.FindClosest(ColorRGB(p[0], p[1], p[2]), last);
+					bench.checksum += last;
+				}
+			});
+
+			bench.Run("Octree::GetPalette", k, w, h, n, [&]() { octree = built_octree; }, [&]()
+			{
+				ColorRGB* octree_palette = octree.GetPalette(k);
+				delete[] octree_palette;
+			});
+
+			//Each backend is measured on its own, the autotuner would pick a different one from run to run. The LUT is left out,
+			//filling its 16M entries would be most of the time
+			for(int b = Nearest_Scalar; b <= Nearest_Grid; ++b)
+			{
+				NearestBackend backend = (NearestBackend)b;
+				char name[64];
+
+				//Average of the iterations needed to converge from the octree palette
+				sprintf(name, "KMeans iteration %s", NearestBackendName(backend));
+				if(bench.Enabled(name))
+				{
+					KMeansOptions kmeans_options;
+					kmeans_options.nearest = backend;
+					BenchResult result;
+					for(int r = 0; r < bench.reps; ++r)
+					{
+						octree = built_octree;
+						ColorRGB* centroids = octree.GetPalette(k);
+						Timer timer;
+						int iterations = KMeansIterate(histogram, centroids, k, kmeans_options);
+						result.samples.push_back(timer.Elapsed() / iterations);
+						delete[] centroids;
+					}
+					bench.Report(name, k, w, h, n, result);
+				}
+
+				const char* names[2] = { "SetPalette", "SetPalette dithering" };
+				for(int dithering = 0; dithering < 2; ++dithering)
+				{
+					sprintf(name, "%s %s", names[dithering], NearestBackendName(backend));
+					bench.Run(name, k, w, h, num_pixels, [&]() { memcpy(img.data, source.data, (size_t)num_pixels * 3); }, [&]()
+					{
+						img.SetPalette(&palette[0], k, dithering != 0, 1, backend);
+					});
+				}
+			}
+		}
+	}
+
+	//Printed so the work can't be optimized away
+	fprintf(stderr, "checksum %lld\n", bench.checksum);
+	return 0;
+}
@@ -0,0 +1,675 @@
+#include "Image.h"
+#include "Histogram.h"
+#include "KMeans.h"
+#include "Stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define popen _popen
+#define pclose _pclose
+#endif
+
+//Generators work from pixel coordinates only (no sequential state) so any row can be produced on its own,
+//huge canvases are written row by row without keeping the whole image in memory
+
+static unsigned int Hash(unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int h = a * 0x8DA6B343u ^ b * 0xD8163841u ^ c * 0xCB1AB31Fu;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return h;
+}
+
+static unsigned char ToByte(float v)
+{
+	return (unsigned char)Clamp((int)(v + 0.5f), 0, 255);
+}
+
+//Smoothly interpolated lattice noise in [0, 1]
+static float ValueNoise(float x, float y, unsigned int seed)
+{
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	float fx = x - x0;
+	float fy = y - y0;
+	fx = fx * fx * (3 - 2 * fx);
+	fy = fy * fy * (3 - 2 * fy);
+
+	float v00 = Hash(x0, y0, seed) * (1.0f / 4294967295.0f);
+	float v10 = Hash(x0 + 1, y0, seed) * (1.0f / 4294967295.0f);
+	float v01 = Hash(x0, y0 + 1, seed) * (1.0f / 4294967295.0f);
+	float v11 = Hash(x0 + 1, y0 + 1, seed) * (1.0f / 4294967295.0f);
+	return (v00 + (v10 - v00) * fx) + ((v01 + (v11 - v01) * fx) - (v00 + (v10 - v00) * fx)) * fy;
+}
+
+static float Fractal(float x, float y, unsigned int seed, int octaves)
+{
+	float sum = 0.0f;
+	float amplitude = 0.5f;
+	for(int o = 0; o < octaves; ++o)
+	{
+		sum += ValueNoise(x, y, seed + o) * amplitude;
+		x *= 2.0f;
+		y *= 2.0f;
+		amplitude *= 0.5f;
+	}
+	return sum;
+}
+
+//Generators that don't depend on the height or the seed leave those parameters unnamed
+typedef void (*GenerateRow)(int w, int h, int y, unsigned char* row, unsigned int seed);
+
+//Smooth horizontal, vertical and radial gradients, the worst case for banding
+static void GenerateGradient(int w, int h, int y, unsigned char* row, unsigned int)
+{
+	for(int x = 0; x < w; ++x, row += 3)
+	{
+		float u = (float)x / w;
+		float v = (float)y / h;
+		float r = sqrtf((u - 0.5f) * (u - 0.5f) + (v - 0.5f) * (v - 0.5f)) * 1.41f;
+		row[0] = ToByte(255 * u);
+		row[1] = ToByte(255 * v);
+		row[2] = ToByte(255 * r);
+	}
+}
+
+//Uniform noise, every pixel a different color
+static void GenerateNoise(int w, int, int y, unsigned char* row, unsigned int seed)
+{
+	for(int x = 0; x < w; ++x, row += 3)
+	{
+		unsigned int v = Hash(x, y, seed);
+		row[0] = v & 0xFF;
+		row[1] = (v >> 8) & 0xFF;
+		row[2] = (v >> 16) & 0xFF;
+	}
+}
+
+//Fractal terrain colored through a few hues with lighting and grain, close to the color distribution of a photo
+static void GeneratePhoto(int w, int h, int y, unsigned char* row, unsigned int seed)
+{
+	static const float ramp[5][3] = { { 20, 40, 90 }, { 60, 110, 160 }, { 190, 170, 120 }, { 70, 120, 50 }, { 240, 240, 235 } };
+	float scale = 6.0f / std::max(w, h);
+	for(int x = 0; x < w; ++x, row += 3)
+	{
+		float height = Fractal(x * scale, y * scale, seed, 8);
+		float light = 0.6f + 0.8f * Fractal(x * scale * 2, y * scale * 2, seed + 100, 4);
+		float t = Clamp((int)(height * 1024), 0, 1023) * (4.0f / 1024);
+		int i = (int)t;
+		float f = t - i;
+		float grain = (Hash(x, y, seed + 200) & 15) - 7.5f;
+		for(int c = 0; c < 3; ++c)
+			row[c] = ToByte((ramp[i][c] + (ramp[i + 1][c] - ramp[i][c]) * f) * light + grain);
+	}
+}
+
+//Flat 16 color tiles with mirrored sprites, few unique colors and hard edges
+static void GeneratePixelArt(int w, int, int y, unsigned char* row, unsigned int seed)
+{
+	static const unsigned char palette[16][3] = {
+		{ 0, 0, 0 }, { 29, 43, 83 }, { 126, 37, 83 }, { 0, 135, 81 }, { 171, 82, 54 }, { 95, 87, 79 }, { 194, 195, 199 }, { 255, 241, 232 },
+		{ 255, 0, 77 }, { 255, 163, 0 }, { 255, 236, 39 }, { 0, 228, 54 }, { 41, 173, 255 }, { 131, 118, 156 }, { 255, 119, 168 }, { 255, 204, 170 } };
+	const int pixel = 4; //Each art pixel is a 4x4 block
+	const int tile = 16;
+	for(int x = 0; x < w; ++x, row += 3)
+	{
+		int px = x / pixel;
+		int py = y / pixel;
+		int tx = px / tile;
+		int ty = py / tile;
+		int sx = px % tile;
+		int sy = py % tile;
+		if(sx >= tile / 2)
+			sx = tile - 1 - sx;
+
+		unsigned int tile_hash = Hash(tx, ty, seed);
+		int background = tile_hash & 1 ? 1 : 12;
+		bool inside = (Hash(tile_hash, sx, sy) & 3) != 0 && sy > 1 && sy < tile - 2 && sx > 1;
+		const unsigned char* color = palette[inside ? (Hash(tile_hash, sx, sy) >> 8) % 16 : background];
+		row[0] = color[0];
+		row[1] = color[1];
+		row[2] = color[2];
+	}
+}
+
+//Window chrome, side bar, buttons and lines of text on a light background, few colors with antialiased glyph edges
+static void GenerateScreenshot(int w, int, int y, unsigned char* row, unsigned int seed)
+{
+	const int title_h = 32;
+	const int sidebar_w = std::min(240, w / 4);
+	const int line_h = 18;
+	const int glyph_w = 8;
+	for(int x = 0; x < w; ++x, row += 3)
+	{
+		unsigned char r = 250, g = 250, b = 252;
+		if(y < title_h)
+		{
+			r = 45; g = 50; b = 60;
+			//Close, minimize and maximize buttons
+			if(x > w - 3 * title_h)
+			{
+				int cx = (x - (w - 3 * title_h)) % title_h - title_h / 2;
+				int cy = y - title_h / 2;
+				if(cx * cx + cy * cy < 49)
+				{
+					r = 230; g = 80; b = 70;
+				}
+			}
+		}
+		else if(x < sidebar_w)
+		{
+			r = 232; g = 236; b = 242;
+			if((y - title_h) / 40 == 3)
+			{
+				r = 60; g = 120; b = 215;
+			}
+		}
+
+		//Text: each cell is a glyph made of hashed strokes, some cells are spaces
+		int line = (y - title_h - 8) / line_h;
+		int gy = (y - title_h - 8) % line_h;
+		int text_x = x - (x < sidebar_w ? 12 : sidebar_w + 24);
+		if(y >= title_h + 8 && gy >= 4 && gy < 14 && text_x >= 0)
+		{
+			int cell = text_x / glyph_w;
+			int gx = text_x % glyph_w;
+			unsigned int glyph = Hash(cell, line, seed) % 40;
+			bool light_text = y < title_h || (x < sidebar_w && (y - title_h) / 40 == 3);
+			if(glyph < 34 && gx >= 1 && gx < 7 && (Hash(glyph, gx / 2, (gy - 4) / 2) & 3) == 0)
+			{
+				//Antialiased edges
+				int alpha = gx == 1 || gx == 6 ? 128 : 255;
+				unsigned char ink = light_text ? 255 : 30;
+				r = (unsigned char)((r * (255 - alpha) + ink * alpha) / 255);
+				g = (unsigned char)((g * (255 - alpha) + ink * alpha) / 255);
+				b = (unsigned char)((b * (255 - alpha) + ink * alpha) / 255);
+			}
+		}
+		row[0] = r;
+		row[1] = g;
+		row[2] = b;
+	}
+}
+
+class CorpusImage
+{
+public:
+	const char* name;
+	GenerateRow generate;
+	bool huge;
+};
+
+static const CorpusImage corpus[] = {
+	{ "gradient", GenerateGradient, false },
+	{ "noise", GenerateNoise, false },
+	{ "photo", GeneratePhoto, false },
+	{ "pixelart", GeneratePixelArt, false },
+	{ "screenshot", GenerateScreenshot, false },
+	{ "huge_photo", GeneratePhoto, true },
+};
+
+//Binary PPM written row by row, stb_image reads it back
+static bool WriteStreamedPPM(const char* path, int w, int h, GenerateRow generate, unsigned int seed)
+{
+	FILE* file = fopen(path, "wb");
+	if(!file)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", w, h);
+	std::vector< unsigned char > row(w * 3);
+	for(int y = 0; y < h; ++y)
+	{
+		generate(w, h, y, &row[0], seed);
+		fwrite(&row[0], 1, row.size(), file);
+	}
+	return fclose(file) == 0;
+}
+
+//Creates path and its missing parents
+static bool MakeDirectory(const std::string& path)
+{
+	for(size_t i = 1; i <= path.size(); ++i)
+	{
+		if(i < path.size() && path[i] != '/' && path[i] != '\\')
+			continue;
+
+		std::string part = path.substr(0, i);
+#ifdef _WIN32
+		_mkdir(part.c_str());
+#else
+		mkdir(part.c_str(), 0777);
+#endif
+	}
+
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+//The list has the image names relative to dir, so the corpus can be moved and run from anywhere
+static int Generate(const char* dir, int w, int h, int huge_w, int huge_h, unsigned int seed)
+{
+	if(!MakeDirectory(dir))
+	{
+		printf("Error creating %s\n", dir);
+		return -1;
+	}
+
+	std::string list_path = std::string(dir) + "/corpus.txt";
+	FILE* list = fopen(list_path.c_str(), "w");
+	if(!list)
+	{
+		printf("Error writing %s\n", list_path.c_str());
+		return -1;
+	}
+
+	for(size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i)
+	{
+		const CorpusImage& image = corpus[i];
+		if(image.huge && (huge_w <= 0 || huge_h <= 0))
+			continue;
+
+		Timer timer;
+		std::string name = std::string(image.name) + (image.huge ? ".ppm" : ".png");
+		std::string path = std::string(dir) + "/" + name;
+		bool ok;
+		if(image.huge)
+		{
+			ok = WriteStreamedPPM(path.c_str(), huge_w, huge_h, image.generate, seed);
+		}
+		else
+		{
+			Image img(w, h, 3);
+			for(int y = 0; y < h; ++y)
+				image.generate(w, h, y, img.data + img.GetIdx(0, y), seed);
+			ok = stbi_write_png(path.c_str(), w, h, 3, img.data, 0) != 0;
+		}
+
+		if(!ok)
+		{
+			printf("Error writing %s\n", path.c_str());
+			fclose(list);
+			return -1;
+		}
+		fprintf(list, "%s\n", name.c_str());
+		printf("%s %dx%d %.0fms\n", path.c_str(), image.huge ? huge_w : w, image.huge ? huge_h : h, timer.Elapsed());
+	}
+
+	fclose(list);
+	return 0;
+}
+
+//CIE L*a*b* (D65) of an sRGB color
+class Lab
+{
+public:
+	float L, a, b;
+
+	static float Linear(int v)
+	{
+		static float table[256];
+		static bool initialized = false;
+		if(!initialized)
+		{
+			for(int i = 0; i < 256; ++i)
+			{
+				float c = i / 255.0f;
+				table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+			initialized = true;
+		}
+		return table[v];
+	}
+
+	static float F(float t)
+	{
+		return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+	}
+
+	Lab(const unsigned char* rgb)
+	{
+		float r = Linear(rgb[0]), g = Linear(rgb[1]), bl = Linear(rgb[2]);
+		float fx = F((0.4124f * r + 0.3576f * g + 0.1805f * bl) / 0.95047f);
+		float fy = F(0.2126f * r + 0.7152f * g + 0.0722f * bl);
+		float fz = F((0.0193f * r + 0.1192f * g + 0.9505f * bl) / 1.08883f);
+		L = 116.0f * fy - 16.0f;
+		a = 500.0f * (fx - fy);
+		b = 200.0f * (fy - fz);
+	}
+};
+
+class Quality
+{
+public:
+	double mse;
+	double psnr;
+	double delta_e; //Mean CIE76 distance
+};
+
+static bool Compare(const Image& source, const Image& result, Quality& quality)
+{
+	if(source.w != result.w || source.h != result.h || source.depth < 3 || result.depth < 3)
+		return false;
+
+	double sum_sq = 0.0;
+	double sum_delta_e = 0.0;
+	for(int y = 0; y < source.h; ++y)
+	{
+		for(int x = 0; x < source.w; ++x)
+		{
+			const unsigned char* a = source.data + source.GetIdx(x, y);
+			const unsigned char* b = result.data + result.GetIdx(x, y);
+			for(int c = 0; c < 3; ++c)
+				sum_sq += (double)((a[c] - b[c]) * (a[c] - b[c]));
+
+			if(a[0] != b[0] || a[1] != b[1] || a[2] != b[2])
+			{
+				Lab lab_a(a), lab_b(b);
+				sum_delta_e += sqrt((double)((lab_a.L - lab_b.L) * (lab_a.L - lab_b.L) + (lab_a.a - lab_b.a) * (lab_a.a - lab_b.a) + (lab_a.b - lab_b.b) * (lab_a.b - lab_b.b)));
+			}
+		}
+	}
+
+	double num_pixels = (double)source.w * source.h;
+	quality.mse = sum_sq / (num_pixels * 3);
+	quality.psnr = quality.mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / quality.mse) : 99.0;
+	quality.delta_e = sum_delta_e / num_pixels;
+	return true;
+}
+
+//Value of a number in the one line JSON printed by -stats json
+static double JSONNumber(const std::string& json, const char* key)
+{
+	std::string pattern = std::string("\"") + key + "\":";
+	size_t pos = json.find(pattern);
+	return pos == std::string::npos ? 0.0 : atof(json.c_str() + pos + pattern.size());
+}
+
+static bool RunQuantizer(const std::string& command, std::string& output)
+{
+	FILE* pipe = popen(command.c_str(), "r");
+	if(!pipe)
+		return false;
+
+	char buffer[1024];
+	output.clear();
+	while(fgets(buffer, sizeof(buffer), pipe))
+		output += buffer;
+	return pclose(pipe) == 0;
+}
+
+static void ParseList(const char* str, std::vector< std::string >& out)
+{
+	out.clear();
+	while(*str)
+	{
+		const char* end = str;
+		while(*end && *end != ',')
+			end ++;
+		out.push_back(std::string(str, end));
+		str = *end ? end + 1 : end;
+	}
+}
+
+//A .txt list has one image per line, relative paths are relative to the list. Other paths are images
+static bool ReadList(const char* path, std::vector< std::string >& images)
+{
+	const char* ext = strrchr(path, '.');
+	if(!ext || strcmp(ext, ".txt"))
+	{
+		images.push_back(path);
+		return true;
+	}
+
+	FILE* file = fopen(path, "r");
+	if(!file)
+	{
+		printf("Error reading %s\n", path);
+		return false;
+	}
+
+	std::string list_path = path;
+	size_t slash = list_path.find_last_of("/\\");
+	std::string dir = slash == std::string::npos ? std::string() : list_path.substr(0, slash + 1);
+
+	char line[4096];
+	while(fgets(line, sizeof(line), file))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if(!line[0])
+			continue;
+
+		bool absolute = line[0] == '/' || line[0] == '\\' || (line[0] && line[1] == ':');
+		images.push_back(absolute ? std::string(line) : dir + line);
+	}
+	fclose(file);
+	return true;
+}
+
+//Error of the histogram colors mapped to their closest centroid
+static long long PaletteSSE(const Histogram& histogram, ColorRGB* palette, int k)
+{
+	long long sse = 0;
+	for(size_t i = 0; i < histogram.entries.size(); ++i)
+	{
+		const HistogramEntry& entry = histogram.entries[i];
+		sse += (long long)entry.color.Dist(palette[FindClosest(entry.color, palette, k)]) * entry.count;
+	}
+	return sse;
+}
+
+//KMeans must return the centroids with the least error it went through, that is, no more error than stopping it after any number of iterations.
+//Returns the number of failures
+static int CheckKMeans(const char* name, const Histogram& histogram, int k)
+{
+	std::vector< ColorRGB > initial(k);
+	for(int c = 0; c < k; ++c)
+		initial[c] = histogram.entries[c * histogram.entries.size() / k].color;
+
+	int failures = 0;
+	for(int mode = 0; mode <= Nearest_Grid + 1; ++mode)
+	{
+		KMeansOptions options;
+		options.bounded = mode > Nearest_Grid;
+		options.nearest = options.bounded ? Nearest_Scalar : (NearestBackend)mode;
+
+		std::vector< ColorRGB > palette(initial);
+		int iterations = KMeansIterate(histogram, &palette[0], k, options);
+		long long sse = PaletteSSE(histogram, &palette[0], k);
+
+		long long min_sse = sse;
+		for(int i = 1; i <= iterations; ++i)
+		{
+			std::vector< ColorRGB > partial(initial);
+			options.max_iterations = i;
+			KMeansIterate(histogram, &partial[0], k, options);
+			min_sse = std::min(min_sse, PaletteSSE(histogram, &partial[0], k));
+		}
+
+		if(sse > min_sse)
+		{
+			printf("FAILED %s k=%d %s: SSE %lld, %lld after fewer iterations\n", name, k, options.bounded ? "bounded" : NearestBackendName(options.nearest), sse, min_sse);
+			failures ++;
+		}
+	}
+	return failures;
+}
+
+static int Check()
+{
+	int failures = 0;
+
+	//Rounding the mean of the first group, (0, 0.5, 0), moves its centroid onto another color at the same distance.
+	//The groups change but the error doesn't go down, kmeans stops there
+	Histogram ties;
+	ties.Add(ColorRGB(0, 0, 0), 2);
+	ties.Add(ColorRGB(1, 0, 1), 2);
+	ties.Add(ColorRGB(0, 1, 0), 2);
+	ties.Add(ColorRGB(0, 1, 1), 2);
+	ties.Finish();
+	failures += CheckKMeans("ties", ties, 3);
+
+	for(size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i)
+	{
+		if(corpus[i].huge)
+			continue;
+
+		Image img(64, 48, 3);
+		for(int y = 0; y < img.h; ++y)
+			corpus[i].generate(img.w, img.h, y, img.data + img.GetIdx(0, y), 1);
+		Histogram histogram(img);
+		for(int k = 2; k <= 16 && k < (int)histogram.entries.size(); k *= 2)
+			failures += CheckKMeans(corpus[i].name, histogram, k);
+	}
+
+	printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+	return failures ? -1 : 0;
+}
+
+static void Usage()
+{
+	printf("Usage: ZIMGQuantHarness gen <output dir> [-size <w>x<h>] [-huge <w>x<h>, 0x0 to skip] [-seed <seed>]\n");
+	printf("       ZIMGQuantHarness run <images or corpus.txt lists...> [-exe <ZIMGQuant path>] [-methods <m1,m2,...>] [-colors <k1,k2,...>] [-dithering <0 or 1>] [-args <extra quantizer arguments>] [-csv <output path>]\n");
+	printf("       ZIMGQuantHarness check\n");
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc == 2 && !strcmp(argv[1], "check"))
+		return Check();
+
+	if(argc < 3)
+	{
+		Usage();
+		return -1;
+	}
+
+	if(!strcmp(argv[1], "gen"))
+	{
+		int w = 1024, h = 768;
+		int huge_w = 12288, huge_h = 8192; //100 megapixels
+		unsigned int seed = 1;
+		for(int i = 3; i + 1 < argc; ++i)
+		{
+			if(!strcmp(argv[i], "-size"))
+				sscanf(argv[++ i], "%dx%d", &w, &h);
+			else if(!strcmp(argv[i], "-huge"))
+				sscanf(argv[++ i], "%dx%d", &huge_w, &huge_h);
+			else if(!strcmp(argv[i], "-seed"))
+				seed = (unsigned int)atoi(argv[++ i]);
+		}
+		return Generate(argv[2], w, h, huge_w, huge_h, seed);
+	}
+
+	if(strcmp(argv[1], "run"))
+	{
+		Usage();
+		return -1;
+	}
+
+	//By default the quantizer is next to the harness
+	std::string exe = argv[0];
+	size_t slash = exe.find_last_of("/\\");
+	exe = (slash == std::string::npos ? std::string() : exe.substr(0, slash + 1)) + "ZIMGQuant";
+
+	std::vector< std::string > images;
+	std::vector< std::string > methods;
+	std::vector< std::string > colors;
+	ParseList("octree,kmeans,minibatch", methods);
+	ParseList("2,4,8,16,32,64,128,256", colors);
+	int dithering = 0;
+	std::string extra_args;
+	const char* csv_path = 0;
+
+	for(int i = 2; i < argc; ++i)
+	{
+		if(argv[i][0] != '-')
+		{
+			if(!ReadList(argv[i], images))
+				return -1;
+		}
+		else if(i + 1 >= argc)
+			break;
+		else if(!strcmp(argv[i], "-exe"))
+			exe = argv[++ i];
+		else if(!strcmp(argv[i], "-methods"))
+			ParseList(argv[++ i], methods);
+		else if(!strcmp(argv[i], "-colors"))
+			ParseList(argv[++ i], colors);
+		else if(!strcmp(argv[i], "-dithering"))
+			dithering = atoi(argv[++ i]);
+		else if(!strcmp(argv[i], "-args"))
+			extra_args = argv[++ i];
+		else if(!strcmp(argv[i], "-csv"))
+			csv_path = argv[++ i];
+	}
+
+	FILE* csv = csv_path ? fopen(csv_path, "w") : stdout;
+	if(!csv)
+	{
+		printf("Error writing %s\n", csv_path);
+		return -1;
+	}
+	fprintf(csv, "image,width,height,unique_colors,method,colors,dithering,total_ms,histogram_ms,palette_ms,kmeans_ms,kmeans_iterations,mapping_ms,peak_memory_mb,mse,psnr,delta_e\n");
+
+	const char* output_path = "zimgquant_harness.png";
+	int failures = 0;
+	for(size_t i = 0; i < images.size(); ++i)
+	{
+		Image source(images[i].c_str());
+		if(!source.data)
+		{
+			fprintf(stderr, "Error loading %s\n", images[i].c_str());
+			failures ++;
+			continue;
+		}
+
+		for(size_t m = 0; m < methods.size(); ++m)
+		{
+			for(size_t c = 0; c < colors.size(); ++c)
+			{
+				std::string command = "\"" + exe + "\" \"" + images[i] + "\" -colors " + colors[c] + " -dithering " + (dithering ? "1" : "0") +
+					" -method " + methods[m] + " -output " + output_path + " -stats json " + extra_args;
+
+				std::string json;
+				if(!RunQuantizer(command, json))
+				{
+					fprintf(stderr, "Failed: %s\n", command.c_str());
+					failures ++;
+					continue;
+				}
+
+				Image result(output_path);
+				Quality quality;
+				if(!result.data || !Compare(source, result, quality))
+				{
+					fprintf(stderr, "Can't compare %s with %s\n", output_path, images[i].c_str());
+					failures ++;
+					continue;
+				}
+
+				fprintf(csv, "%s,%d,%d,%d,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%d,%.3f,%.1f,%.4f,%.3f,%.4f\n", images[i].c_str(), source.w, source.h,
+					(int)JSONNumber(json, "unique_colors"), methods[m].c_str(), colors[c].c_str(), dithering,
+					JSONNumber(json, "total_ms"), JSONNumber(json, "histogram_ms"), JSONNumber(json, "palette_ms"), JSONNumber(json, "kmeans_ms"),
+					(int)JSONNumber(json, "kmeans_iterations"), JSONNumber(json, "mapping_ms"), JSONNumber(json, "peak_memory") / (1024.0 * 1024.0),
+					quality.mse, quality.psnr, quality.delta_e);
+				fflush(csv);
+			}
+		}
+	}
+
+	remove(output_path);
+	if(csv != stdout)
+		fclose(csv);
+	return failures ? 1 : 0;
+}